@@ -0,0 +1,203 @@
+/*
+ * memlib.c - a module that simulates the memory system.  Needed because it 
+ *            allows us to interleave calls from the student's malloc package 
+ *            with the system's malloc package in libc.
+ *
+ *            Regions that live outside the simulated sbrk heap, such as
+ *            huge blocks, are mapped directly from the OS with mem_map.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+
+#include "memlib.h"
+
+/* Largest heap the simulated sbrk will hand out. It is only
+ * reserved up front, so the preload build can make it large. */
+#ifndef MAX_HEAP
+#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#endif
+
+/* private variables */
+static char *mem_start_brk;  /* points to first byte of heap */
+static char *mem_brk;        /* points to last byte of heap */
+static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_high_brk;   /* highest brk so far; above it the heap is still zero */
+
+/* 
+ * mem_init - initialize the memory system model
+ */
+void mem_init(void)
+{
+    /* reserve the storage we will use to model the available VM;
+     * untouched pages stay zero and unbacked, like a real sbrk */
+    mem_start_brk = mmap(NULL, MAX_HEAP, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_start_brk == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+
+    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_high_brk = mem_start_brk;
+}
+
+/* 
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    mem_unmap(mem_start_brk, MAX_HEAP);
+}
+
+/*
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void mem_reset_brk()
+{
+    mem_brk = mem_start_brk;
+}
+
+/* 
+ * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr gives the top of the heap back, but never
+ *    below its start.
+ */
+void *mem_sbrk(intptr_t incr) 
+{
+    char *old_brk = mem_brk;
+
+    if ( (incr < 0 && -incr > mem_brk - mem_start_brk) || ((mem_brk + incr) > mem_max_addr)) {
+	errno = ENOMEM;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    mem_brk += incr;
+    if (mem_brk > mem_high_brk)
+	mem_high_brk = mem_brk;
+    return (void *)old_brk;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo()
+{
+    return (void *)mem_start_brk;
+}
+
+/* 
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi()
+{
+    return (void *)(mem_brk - 1);
+}
+
+/*
+ * mem_heap_untouched - return the first heap byte mem_sbrk has never
+ *    handed out, even before a mem_reset_brk. Everything from there
+ *    up to the end of the model still reads as zero.
+ */
+void *mem_heap_untouched()
+{
+    return (void *)mem_high_brk;
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() 
+{
+    return (size_t)(mem_brk - mem_start_brk);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize()
+{
+    return (size_t)getpagesize();
+}
+
+/*
+ * mem_purge - tell the OS the pages in [addr, addr+len) are unused.
+ *    They stay mapped and read back as zero. addr and len must be
+ *    page aligned.
+ */
+void mem_purge(void *addr, size_t len)
+{
+    madvise(addr, len, MADV_DONTNEED);
+}
+
+/*
+ * mem_map - map size bytes of zeroed memory outside the sbrk heap.
+ *    size must be a multiple of the page size. Returns (void *)-1
+ *    on failure, like mem_sbrk.
+ */
+void *mem_map(size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    return p;
+}
+
+/*
+ * mem_unmap - return a region obtained from mem_map to the OS
+ */
+void mem_unmap(void *ptr, size_t size)
+{
+    munmap(ptr, size);
+}
+
+/*
+ * mem_reserve - map size bytes of address space aligned to size,
+ *    which must be a power of two. Pages are only backed by memory
+ *    once touched. Returns (void *)-1 on failure; give the region
+ *    back with mem_unmap.
+ */
+void *mem_reserve(size_t size)
+{
+    char *p = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    size_t lead;
+
+    if (p == MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    lead = (size - ((uintptr_t)p & (size - 1))) & (size - 1);
+    if (lead)
+	munmap(p, lead);
+    munmap(p + lead + size, size - lead);
+    return p + lead;
+}
+
+/*
+ * mem_remap - resize a mem_map region to new_size bytes, moving it
+ *    if it cannot grow in place. Returns (void *)-1 on failure, in
+ *    which case the old mapping is untouched.
+ */
+void *mem_remap(void *ptr, size_t old_size, size_t new_size)
+{
+    void *p = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE);
+
+    if (p == MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    return p;
+}
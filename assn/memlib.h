@@ -4,5 +4,12 @@ void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_untouched(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void mem_purge(void *addr, size_t len);
+
+void *mem_map(size_t size);
+void mem_unmap(void *ptr, size_t size);
+void *mem_remap(void *ptr, size_t old_size, size_t new_size);
+void *mem_reserve(size_t size);
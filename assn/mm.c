@@ -3,8 +3,25 @@
  * the free list.
  * The binning strategy used is to have ranges of sizes for large
  * sized free blocks and direct mapping for smaller sized blocks.
+ * A bitmap of non-empty bins lets malloc jump straight to the first
+ * usable bin.
  * Blocks are coalesced and split accordingly
- * Realloc is implemented directly using mm_malloc and mm_free.
+ * Realloc grows blocks in place where it can: into a free next
+ * block, into the top chunk, or by sliding down into a free
+ * previous block. Only when none of those has room is the payload
+ * copied to a new block and the old one freed.
+ * Requests of up to 64 bytes come from headerless slab runs.
+ * Small blocks are recycled through a per-thread cache, and freed
+ * blocks up to TREE_MIN wait on per-size quick lists before they
+ * are coalesced. The heap
+ * itself is split into arenas, each with its own lock, free lists
+ * and region, and threads are spread over them round-robin.
+ * Huge requests get their own mapping outside the sbrk heap.
+ * Misses are carved from a top chunk at the end of each arena,
+ * which grows geometrically and absorbs trailing free blocks.
+ * Cheap event counters in every arena feed mm_stats().
+ * mm_heap_create hands out private arenas that are freed whole.
+ * Regions are bare bump allocators for objects that die together.
  *
  */
 #include <stdio.h>
@@ -13,6 +30,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
@@ -41,10 +59,18 @@ team_t team = {
 #define WSIZE       sizeof(void *)            /* word size (bytes) */
 #define DSIZE       (2 * WSIZE)            /* doubleword size (bytes) */
 #define CHUNKSIZE   (1<<7)      /* initial heap size (bytes) */
-#define OVERHEAD	DSIZE
+#define OVERHEAD	WSIZE      /* allocated blocks carry a header only */
+#define MIN_BLOCK   (2 * DSIZE)    /* header, two list links, footer */
+#define MAX_REQUEST PTRDIFF_MAX    /* larger sizes would wrap when adjusted */
 #define MAX(x,y) ((x) > (y)?(x) :(y))
+#define MIN(x,y) ((x) < (y)?(x) :(y))
 
-/* Pack a size and allocated bit into a word */
+/* Header flags kept in the low bits under the aligned size */
+#define ALLOC       0x1
+#define PREV_ALLOC  0x2        /* previous block is allocated */
+#define MMAPPED     0x4        /* huge block with its own mapping */
+
+/* Pack a size and allocated bits into a word */
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* Read and write a word at address p */
@@ -53,20 +79,245 @@ team_t team = {
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)     (GET(p) & ~(DSIZE - 1))
-#define GET_ALLOC(p)    (GET(p) & 0x1)
+#define GET_ALLOC(p)    (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
 
-/* Given block ptr bp, compute address of its header and footer */
+/* Given block ptr bp, compute address of its header and footer.
+ * Only free blocks have a footer. */
 #define HDRP(bp)        ((char *)(bp) - WSIZE)
 #define FTRP(bp)        ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks */
+/* Given block ptr bp, compute address of next and previous blocks.
+ * PREV_BLKP reads the previous footer, so it is only valid when
+ * the PREV_ALLOC bit of bp is clear. */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
-#define BIN_SIZE 64
-
-//#define NUM_BINS 66
-#define NUM_BINS 33
+/* The owner of an allocated block reads its header without the
+ * arena lock (mm_free), while a neighbour holding the lock may
+ * rewrite the PREV_ALLOC bit of that same word. Both go through
+ * relaxed atomics; the size bits never change under the reader. */
+#define GET_SHARED(p)      __atomic_load_n((uintptr_t *)(p), __ATOMIC_RELAXED)
+#define PUT_SHARED(p,val)  __atomic_store_n((uintptr_t *)(p), (val), __ATOMIC_RELAXED)
+
+/* Update the PREV_ALLOC bit in the header of the block after bp */
+#define SET_NEXT_PREV_ALLOC(bp)   PUT_SHARED(HDRP(NEXT_BLKP(bp)), GET(HDRP(NEXT_BLKP(bp))) | PREV_ALLOC)
+#define CLEAR_NEXT_PREV_ALLOC(bp) PUT_SHARED(HDRP(NEXT_BLKP(bp)), GET(HDRP(NEXT_BLKP(bp))) & ~(uintptr_t)PREV_ALLOC)
+
+#define NUM_BINS 64
+
+/* Bins 0..NUM_SMALL_BINS-1 hold exactly one size each (DSIZE steps),
+ * the rest split each power of two above SMALL_BIN_MAX into SUB_BINS */
+#define NUM_SMALL_BINS  16
+#define SMALL_BIN_SHIFT 8
+#define SMALL_BIN_MAX   (NUM_SMALL_BINS * DSIZE)
+#define SUB_BIN_SHIFT   2
+#define SUB_BINS        (1 << SUB_BIN_SHIFT)
+
+/* How getBestFit picks a block within a bin */
+#define FIT_FIRST   0
+#define FIT_BEST    1
+#define FIT_GOOD    2
+
+#ifndef FIT_POLICY
+#define FIT_POLICY  FIT_BEST
+#endif
+#define GOOD_FIT_CANDIDATES 8
+
+/* Free blocks above TREE_MIN live in a red-black tree instead of
+ * the lists; TREE_BIN is the first bin entirely above TREE_MIN */
+#define TREE_MIN    1024
+#define TREE_BIN    (NUM_SMALL_BINS + 2*SUB_BINS)
+
+/* Tree links overlay the payload of a free block */
+#define TREE_LEFT(bp)   (*(void **)(bp))
+#define TREE_RIGHT(bp)  (*(void **)((char *)(bp) + WSIZE))
+#define TREE_PARENT(bp) (*(void **)((char *)(bp) + 2*WSIZE))
+#define TREE_COLOR(bp)  (*(uintptr_t *)((char *)(bp) + 3*WSIZE))
+#define TREE_STAMP(bp)  (*(uintptr_t *)((char *)(bp) + 4*WSIZE))
+#define TREE_NODE   (5 * WSIZE)
+#define RED         1
+#define BLACK       0
+#define IS_RED(bp)  ((bp) != NULL && TREE_COLOR(bp) == RED)
+
+/* Free-list order for sorted bins and the tree: smaller first, then lower address */
+#define blockBefore(a, b) (GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b)) || \
+        (GET_SIZE(HDRP(a)) == GET_SIZE(HDRP(b)) && (char *)(a) < (char *)(b)))
+
+/* floor(log2(x)) for x > 0 */
+#define FLOOR_LOG2(x)   (63 - __builtin_clzl(x))
+
+/* Bit i of binMap is set iff bin i of the segregated list is non-empty */
+#define BIN_BIT(i)      ((uint64_t)1 << (i))
+
+
+/* Free memory goes back to the OS on a decay schedule: every
+ * PURGE_INTERVAL frees start a new epoch, and tree blocks that
+ * stayed free for PURGE_DECAY epochs have their pages purged.
+ * Only mm_trim() lowers the break. */
+#define PURGE_INTERVAL  1024
+#define PURGE_DECAY     4
+#define PURGE_MIN       (1 << 14)   /* smaller blocks aren't worth a syscall */
+#define PURGED          (~(uintptr_t)0)     /* TREE_STAMP of a purged block */
+
+/* A block grown by GROW_STREAK reallocs in a row is treated as an
+ * appending buffer: when it has to move or absorb a neighbour it
+ * keeps 1/2^GROW_SHIFT of its size as headroom for the next steps */
+#define GROW_STREAK     3
+#define GROW_SHIFT      1
+
+/* Freed blocks of up to QUICK_MAX bytes stay allocated on an exact
+ * size LIFO per arena and are reused without a split. They are
+ * coalesced all at once when a request misses the free lists or
+ * the lists hold more than QUICK_BUDGET bytes. */
+#define QUICK_MAX       TREE_MIN
+#define QUICK_LISTS     (QUICK_MAX / DSIZE)
+#define QUICK_INDEX(size)   ((size) / DSIZE - 1)
+#define QUICK_BUDGET    (1 << 16)
+
+/* Check builds (-DMM_CHECK_INTERVAL=n) run mm_check every n calls
+ * to mm_malloc, mm_free and mm_realloc and abort on a bad heap */
+#ifdef MM_CHECK_INTERVAL
+#define CHECK_TICK()    checkTick()
+#else
+#define CHECK_TICK()
+#endif
+
+/* Regions reserve REGION_SIZE of address space; mm_region_reset
+ * keeps the first REGION_KEEP bytes backed and purges the rest */
+#define REGION_SIZE     ARENA_SIZE
+#define REGION_KEEP     (1 << 20)
+
+/* Requests of at least this many bytes get their own mapping;
+ * adjustable at run time with mm_set_mmap_threshold() */
+#define MMAP_THRESHOLD  (1 << 20)
+
+/* The top chunk grows by 1/2^TOP_GROW_SHIFT of the heap, at least
+ * CHUNKSIZE and at most TOP_GROW_MAX bytes beyond the request, so
+ * a burst of misses costs a few mem_sbrk calls instead of one each */
+#define TOP_GROW_SHIFT  6
+#define TOP_GROW_MAX    (1 << 20)
+
+/* mm_calloc lets the OS zero the whole pages of recycled blocks
+ * at least this big instead of writing them */
+#define CALLOC_DISCARD  (1 << 17)
+
+/* Free blocks alignedFit looks at before settling for an
+ * over-sized block */
+#define ALIGN_CANDIDATES 32
+
+/* Slab runs: RUN_SIZE-aligned pages of equal headerless slots */
+#define SLAB_MAX        64      /* largest request served by a slab */
+#define SLAB_CLASSES    (SLAB_MAX / DSIZE)
+#define RUN_SHIFT       12
+#define RUN_SIZE        (1 << RUN_SHIFT)
+#define RUN_MAP_WORDS   ((ARENA_SIZE >> RUN_SHIFT) / 64)  /* page map covers one ARENA_SIZE */
+
+/* Slab class serving a request of size bytes (1..SLAB_MAX) */
+#define SLAB_CLASS(size)    (((size) - 1) / DSIZE)
+
+/* Run owning slab pointer p */
+#define SLAB_RUN(p)     ((slab_run_t *)((uintptr_t)(p) & ~(uintptr_t)(RUN_SIZE - 1)))
+
+typedef struct slab_run {
+    struct slab_run* next;      /* partial-run list links */
+    struct slab_run* prev;
+    unsigned int cls;           /* slab class */
+    unsigned int slotSize;
+    unsigned int nslots;
+    unsigned int nfree;
+    uint64_t freeMap[4];        /* bit set = slot free */
+} slab_run_t;
+
+/* First slot sits just past the run header */
+#define RUN_HEADER      (DSIZE * ((sizeof(slab_run_t) + DSIZE - 1) / DSIZE))
+
+/* Per-thread cache of freed blocks, one LIFO per exact-size bin
+ * followed by one per slab class */
+#define TCACHE_BINS     (NUM_SMALL_BINS + SLAB_CLASSES)
+#define TCACHE_MAX      16      /* blocks held per bin */
+#define TCACHE_BATCH    8       /* blocks moved per refill or flush */
+
+/* Arenas: independent heaps with a lock each. Arena 0 is the
+ * mem_sbrk heap; the others sit at the start of an ARENA_SIZE
+ * aligned region of their own, so any block finds its arena from
+ * its address. */
+#define MAX_ARENAS      64
+#define ARENAS_PER_CPU  4       /* so threads rarely share even when oversubscribed */
+#ifndef ARENA_SHIFT
+#define ARENA_SHIFT     28      /* the preload build raises it, see Makefile */
+#endif
+#define ARENA_SIZE      ((size_t)1 << ARENA_SHIFT)
+#define ARENA_MAP_WORDS ((((uintptr_t)1 << 47) >> ARENA_SHIFT) / 64)
+
+/* Event counters of one arena, bumped under its lock; see mm_stats */
+typedef struct {
+    size_t fitCalls;            /* getBestFit calls */
+    size_t fitExamined;         /* blocks those calls looked at */
+    size_t fitMax;
+    size_t fitHist[MM_STAT_FIT_HIST];
+    size_t splits;
+    size_t coalesces;
+    size_t sbrkCalls;
+} arena_stats_t;
+
+typedef struct arena {
+    pthread_mutex_t lock;
+    char* start;                /* region, grown from start up to brk */
+    char* brk;
+    char* end;
+    char* fresh;                /* never written from here up, so still zero */
+    void* heapStart;            /* NUM_BINS segregated list heads */
+    void* top;                  /* last block before the epilogue, or NULL; see topTake */
+    size_t heapSize;
+    uint64_t binMap;
+    void* treeRoot;
+
+    /* Decay clock for purging; see PURGE_INTERVAL */
+    uintptr_t purgeEpoch;
+    unsigned int freeOps;
+
+    /* Runs with at least one free slot, per slab class */
+    slab_run_t* slabPartial[SLAB_CLASSES];
+
+    /* Bit i is set iff run page runBasePage+i belongs to a slab */
+    uint64_t runMap[RUN_MAP_WORDS];
+    uintptr_t runBasePage;
+
+    /* Last block resized by reallocBlock and how many growths in a row */
+    void* growPtr;
+    size_t growSize;
+    unsigned int growSteps;
+
+    /* Blocks other threads freed, pushed without the lock; see remoteFree */
+    void* remoteFrees;
+
+    /* Freed blocks not yet coalesced, by exact size; see QUICK_MAX */
+    void* quick[QUICK_LISTS];
+    size_t quickBytes;
+
+    /* Set for mm_heap_create heaps, which keep every block in their
+     * region and are listed on heaps instead of arenas[] */
+    int isHeap;
+    struct arena* heapNext;
+
+    arena_stats_t stats;
+} arena_t;
+
+/* A bump allocator at the start of its own reservation; see mm_region_create */
+typedef struct region {
+    char* next;                 /* first unused byte */
+    char* end;
+    char* touched;              /* high-water mark of next since the last purge */
+} region_t;
+
+typedef struct {
+    unsigned long epoch;        /* heapEpoch the entries belong to */
+    int registered;             /* thread-exit flush is armed */
+    arena_t* home;              /* arena this thread allocates from */
+    void* head[TCACHE_BINS];
+    int count[TCACHE_BINS];
+} tcache_t;
 
 
 /******* Function Headers*********************/
@@ -79,15 +330,130 @@ void updateOH(void* blockPointer,size_t adjustedSize);
 void removeFromFreeList(void* blockPointer);
 void addFreeList(void* blockPointer);
 
+/*******Large free block tree******************/
+void treeInsert(void* bp);
+void treeRemove(void* bp);
+void *treeBestFit(size_t adjustedSize);
+void treeReplaceChild(void* parent, void* old, void* new);
+void treeTransplant(void* u, void* v);
+void treeRotateLeft(void* x);
+void treeRotateRight(void* x);
+
+/*******Quick list functions*******************/
+void quickPush(void* bp);
+void *quickPop(int index);
+void quickConsolidate(void);
+
+/*******Purging functions**********************/
+size_t purgeBlock(void* bp);
+size_t purgeTree(void* node, uintptr_t before);
+size_t trimTop(void);
+
+/*******Arena heap, called with arena->lock held*****/
+void *mallocBlock(size_t adjustedSize);
+void freeBlock(void *blockPointer);
+void freeSpan(void* bp, size_t size, unsigned int blocks);
+void zeroBlock(void* bp, size_t bytes, char* fresh);
+
+/*******Top chunk functions*******************/
+int topGrow(size_t size);
+void *topTake(size_t size);
+void releaseBlock(void* bp);
+size_t carveBatch(size_t asize, size_t n, void** out);
+void *reallocBlock(void *ptr, size_t size);
+void trimBlock(void* bp, size_t asize);
+
+/*******Slab functions*************************/
+void *heapAlloc(size_t size);
+void heapFree(void *ptr);
+void *allocAlignedBlock(size_t align, size_t payload);
+void *alignedFit(size_t align, size_t asize);
+size_t alignedLead(void* bp, size_t align);
+int isSlabPointer(void *ptr);
+void *slabAlloc(size_t size);
+void slabFree(void *ptr);
+slab_run_t* newRun(int cls);
+void setRunMapped(slab_run_t* run, int mapped);
+void linkRun(slab_run_t* run);
+void unlinkRun(slab_run_t* run);
+
+/*******Huge block functions*******************/
+int isHugePointer(void *ptr);
+void *hugeAlloc(size_t size);
+void *hugeAlignedAlloc(size_t align, size_t size);
+void hugeFree(void *ptr);
+void *hugeRealloc(void *ptr, size_t size);
+
+/*******Arena functions************************/
+void arenaLock(arena_t* a);
+void arenaUnlock(void);
+arena_t* arenaOf(void* ptr);
+arena_t* arenaCreate(void);
+arena_t* arenaAssign(void);
+int arenaSetup(arena_t* a);
+void *arenaSbrk(intptr_t incr);
+void remoteFree(arena_t* a, void* ptr);
+void arenaDrain(void);
+void arenaMapSet(arena_t* a, int mapped);
+
+/*******Per-thread cache functions*************/
+tcache_t* tcacheLocal(void);
+void tcacheRefill(tcache_t* tc, int index);
+void tcacheFlush(tcache_t* tc, int index, int keep);
+void tcachePush(tcache_t* tc, int index, void* ptr);
+void tcacheRelease(void* arg);
+void tcacheMakeKey(void);
+
+/*******Statistics functions*******************/
+void statsFit(size_t examined);
+void statsTree(void* node, mm_stats_t* st);
+void statsArena(mm_stats_t* st);
+
+/*******Heap checker functions*****************/
+int checkArena(void);
+int checkFail(const char* what, void* bp);
+int checkClaim(uint64_t* map, void* bp);
+int checkBlocks(uint64_t* map);
+int checkBins(uint64_t* map);
+int checkQuick(void);
+int checkTree(uint64_t* map, void* node, void* parent, void* lo, void* hi);
+int checkUnlisted(uint64_t* map, size_t words);
+void checkTick(void);
 
 /* Global variables*/
-void* heap_listp = NULL;
-void* HeapStart = NULL;
-void* MemStart = NULL;
+size_t mmapThreshold = MMAP_THRESHOLD;
+
+/* mm_realloc calls that returned the same pointer, and that moved */
+size_t reallocInPlace = 0;
+size_t reallocCopied = 0;
+
+/* Huge blocks currently mapped */
+size_t hugeBlocks = 0;
+size_t hugeBytes = 0;
 
+/* Arena 0 lives in the mem_sbrk heap; the others are created on
+ * first use, at most numArenas of them */
+arena_t mainArena = { .lock = PTHREAD_MUTEX_INITIALIZER };
+arena_t* arenas[MAX_ARENAS];
+int numArenas = 1;
+unsigned int arenaTurn = 0;
+pthread_mutex_t arenasLock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Live mm_heap_create heaps, under arenasLock */
+arena_t* heaps = NULL;
 
-size_t HeapSize = 0;
+/* Bit i is set iff the ARENA_SIZE slot at i << ARENA_SHIFT holds an arena */
+uint64_t arenaMap[ARENA_MAP_WORDS];
+
+/* The arena the heap functions work on, set by arenaLock */
+__thread arena_t* arena;
+
+/* Bumped by mm_init so thread caches notice the heap was reset */
+unsigned long heapEpoch = 0;
+
+__thread tcache_t tcache;
+pthread_key_t tcacheKey;
+pthread_once_t tcacheKeyOnce = PTHREAD_ONCE_INIT;
 
 void* extend_heap_init(size_t);
 
@@ -101,7 +467,7 @@ void printSegList()
     for(i =0; i< NUM_BINS; i++)
     {
         int label = (i+1)*16;
-        void* binPtr = HeapStart + WSIZE*i;
+        void* binPtr = arena->heapStart + WSIZE*i;
         if(binPtr)
         {
             void* currentNode = GET(binPtr);
@@ -119,20 +485,54 @@ void printSegList()
 /**********************************************************
  * mm_init
  * Initialize the heap.
+ * Drops every arena but arena 0, which is rebuilt on the
+ * mem_sbrk heap. Threads pick their arena again on next use.
+ **********************************************************/
+int mm_init(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+
+    for(i = 1; i < MAX_ARENAS; i++)
+    {
+        if(arenas[i])
+        {
+            arenaMapSet(arenas[i], 0);
+            mem_unmap(arenas[i], ARENA_SIZE);
+        }
+        arenas[i] = NULL;
+    }
+    numArenas = (cpus < 1) ? 1 : MIN(cpus * ARENAS_PER_CPU, MAX_ARENAS);
+    arenaTurn = 0;
+    heapEpoch++;
+
+    mainArena.start = (char *)mem_heap_lo();
+    mainArena.brk = mainArena.start + mem_heapsize();
+    mainArena.fresh = mem_heap_untouched();
+    arenas[0] = &mainArena;
+    return arenaSetup(&mainArena);
+}
+
+/**********************************************************
+ * arenaSetup
+ * Lay out an empty heap at the break of arena a and make it
+ * the current arena.
  * Stores address to different segregations.
  * Extends heap by NUM_BINS
  **********************************************************/
 
- int mm_init(void){
+ int arenaSetup(arena_t* a){
 		
 		int i;
+		void* heap_listp;
 		
-		if((heap_listp = mem_sbrk(4*WSIZE)) == (void *)-1)
+		arena = a;
+		if((heap_listp = arenaSbrk(4*WSIZE)) == (void *)-1)
          	return -1;
      	PUT(heap_listp, 0);                         // alignment padding
-     	PUT(heap_listp + (1 * WSIZE), PACK(OVERHEAD, 1));   // prologue header
-    	PUT(heap_listp + (2 * WSIZE), PACK(OVERHEAD, 1));   // prologue footer
-     	PUT(heap_listp + (3 * WSIZE), PACK(0, 1));    // epilogue header
+     	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, ALLOC | PREV_ALLOC));   // prologue header
+    	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, ALLOC));   // prologue footer
+     	PUT(heap_listp + (3 * WSIZE), PACK(0, ALLOC | PREV_ALLOC));    // epilogue header
      	heap_listp += DSIZE;
      	
      	void* temp;
@@ -142,33 +542,248 @@ void printSegList()
      	
      	int size = (words % 2 ) ? (words + 1) * WSIZE: words * WSIZE;
      	
-     	  if ( (temp = mem_sbrk(size)) == (void *)-1 )
-                return NULL;
+     	  if ( (temp = arenaSbrk(size)) == (void *)-1 )
+                return -1;
      	
-     	PUT(HDRP(temp), PACK(size, 1));                // free block header
-        PUT(FTRP(temp), PACK(size, 1));                // free block footer
-        PUT(HDRP(NEXT_BLKP(temp)), PACK(0, 1));        // new epilogue header
+     	PUT(HDRP(temp), PACK(size, ALLOC | PREV_ALLOC));   // seg list block header
+        PUT(HDRP(NEXT_BLKP(temp)), PACK(0, ALLOC | PREV_ALLOC));   // new epilogue header
  		
      	
-     	HeapStart = temp;
+     	arena->heapStart = temp;
+     	arena->heapSize = 0;
+     	arena->top = NULL;
+     	if(arena->fresh < arena->brk)
+     	    arena->fresh = arena->brk;
      	
      	for(i=0; i<NUM_BINS;i++)
      	{
-      		 PUT(HeapStart+i*WSIZE, NULL);
+      		 PUT(arena->heapStart+i*WSIZE, 0);
       	}
+     	arena->binMap = 0;
+     	arena->treeRoot = NULL;
+     	arena->purgeEpoch = 0;
+     	arena->freeOps = 0;
+     	arena->growPtr = NULL;
+     	arena->growSteps = 0;
+     	arena->remoteFrees = NULL;
+     	memset(arena->quick, 0, sizeof(arena->quick));
+     	arena->quickBytes = 0;
+     	memset(&arena->stats, 0, sizeof(arena->stats));
+
+     	memset(arena->slabPartial, 0, sizeof(arena->slabPartial));
+     	memset(arena->runMap, 0, sizeof(arena->runMap));
+     	arena->runBasePage = (uintptr_t)arena->start >> RUN_SHIFT;
      	
      	return 0;
 }
 
+/**********************************************************
+ * Arenas
+ * Each arena is a complete heap: prologue, segregated lists,
+ * tree, slabs and a region it grows with arenaSbrk. The heap
+ * functions work on the thread's current arena, which
+ * arenaLock sets. Arena 0 uses the mem_sbrk heap itself;
+ * the others reserve an ARENA_SIZE aligned region and keep
+ * their arena_t at its start, so arenaOf finds the owner of
+ * any block from its address alone.
+ **********************************************************/
+
+/* Lock a and point the heap functions at it */
+void arenaLock(arena_t* a)
+{
+    pthread_mutex_lock(&a->lock);
+    arena = a;
+}
+
+void arenaUnlock(void)
+{
+    pthread_mutex_unlock(&arena->lock);
+}
+
+/* Arena whose region holds ptr, or NULL for a huge block */
+arena_t* arenaOf(void* ptr)
+{
+    uintptr_t slot = (uintptr_t)ptr >> ARENA_SHIFT;
+
+    if((char *)ptr >= mainArena.start
+       && (char *)ptr < __atomic_load_n(&mainArena.brk, __ATOMIC_RELAXED))
+        return &mainArena;
+    if(slot < ARENA_MAP_WORDS * 64
+       && (__atomic_load_n(&arenaMap[slot / 64], __ATOMIC_ACQUIRE) >> (slot % 64)) & 1)
+        return (arena_t *)(slot << ARENA_SHIFT);
+    return NULL;
+}
+
+/* mem_sbrk for the current arena. Arena 0 moves the real break;
+ * the others move a break inside their region. Whole pages given
+ * back are purged either way, since mem_sbrk only moves the model
+ * break. */
+void *arenaSbrk(intptr_t incr)
+{
+    char* old = arena->brk;
+    uintptr_t page = mem_pagesize();
+    uintptr_t from, to;
+
+    arena->stats.sbrkCalls++;
+    if(arena == &mainArena)
+    {
+        if((old = mem_sbrk(incr)) == (void *)-1)
+            return (void *)-1;
+    }
+    else if((incr < 0 && -incr > old - arena->start) || incr > arena->end - old)
+    {
+        return (void *)-1;
+    }
+
+    if(incr < 0)
+    {
+        from = ((uintptr_t)old + incr + page - 1) & ~(page - 1);
+        to = ((uintptr_t)old + page - 1) & ~(page - 1);
+        if(from < to)
+            mem_purge((void *)from, to - from);
+    }
+    __atomic_store_n(&arena->brk, old + incr, __ATOMIC_RELAXED);
+    return old;
+}
+
+/* Queue ptr for arena a without taking its lock. The list is
+ * threaded through the first payload word and the block stays
+ * marked allocated until the owner drains it. */
+void remoteFree(arena_t* a, void* ptr)
+{
+    void* head = __atomic_load_n(&a->remoteFrees, __ATOMIC_RELAXED);
+
+    do {
+        PUT(ptr, (uintptr_t)head);
+    } while(!__atomic_compare_exchange_n(&a->remoteFrees, &head, ptr, 1,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Free everything queued on the current arena in one batch; arena->lock held */
+void arenaDrain(void)
+{
+    void* bp = __atomic_exchange_n(&arena->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+    void* next;
+
+    while(bp)
+    {
+        next = (void *)GET(bp);
+        heapFree(bp);
+        bp = next;
+    }
+}
+
+/* Reserve a region for a new arena and lay its heap out; NULL on failure */
+arena_t* arenaCreate(void)
+{
+    arena_t* a;
+
+    if((a = mem_reserve(ARENA_SIZE)) == (void *)-1)
+        return NULL;
+
+    pthread_mutex_init(&a->lock, NULL);
+    a->start = (char *)a + DSIZE * ((sizeof(arena_t) + DSIZE - 1) / DSIZE);
+    a->brk = a->start;
+    a->fresh = a->start;
+    a->end = (char *)a + ARENA_SIZE;
+    if(arenaSetup(a) == -1)
+    {
+        mem_unmap(a, ARENA_SIZE);
+        return NULL;
+    }
+
+    arenaMapSet(a, 1);
+    return a;
+}
+
+/* Tell arenaOf whether the region of a holds an arena */
+void arenaMapSet(arena_t* a, int mapped)
+{
+    uintptr_t slot = (uintptr_t)a >> ARENA_SHIFT;
+
+    if(mapped)
+        __atomic_fetch_or(&arenaMap[slot / 64], (uint64_t)1 << (slot % 64), __ATOMIC_RELEASE);
+    else
+        __atomic_fetch_and(&arenaMap[slot / 64], ~((uint64_t)1 << (slot % 64)), __ATOMIC_RELEASE);
+}
+
+/* Hand the calling thread the next arena in round-robin order,
+ * falling back to arena 0 if a new one can't be reserved */
+arena_t* arenaAssign(void)
+{
+    int i = __atomic_fetch_add(&arenaTurn, 1, __ATOMIC_RELAXED) % numArenas;
+    arena_t* a;
+
+    pthread_mutex_lock(&arenasLock);
+    if(arenas[i] == NULL)
+        arenas[i] = arenaCreate();
+    a = arenas[i] ? arenas[i] : &mainArena;
+    pthread_mutex_unlock(&arenasLock);
+    return a;
+}
+
+
+/**********************************************************
+ * mm_fork_prepare, mm_fork_parent, mm_fork_child
+ * pthread_atfork handlers. Every arena lock is held across
+ * fork, so the child never inherits a heap another thread
+ * was in the middle of changing.
+ **********************************************************/
+void mm_fork_prepare(void)
+{
+    arena_t* h;
+    int i;
+
+    pthread_mutex_lock(&arenasLock);
+    for(i = 0; i < MAX_ARENAS; i++)
+    {
+        if(arenas[i])
+            pthread_mutex_lock(&arenas[i]->lock);
+    }
+    for(h = heaps; h; h = h->heapNext)
+        pthread_mutex_lock(&h->lock);
+}
+
+void mm_fork_parent(void)
+{
+    arena_t* h;
+    int i;
+
+    for(h = heaps; h; h = h->heapNext)
+        pthread_mutex_unlock(&h->lock);
+    for(i = MAX_ARENAS - 1; i >= 0; i--)
+    {
+        if(arenas[i])
+            pthread_mutex_unlock(&arenas[i]->lock);
+    }
+    pthread_mutex_unlock(&arenasLock);
+}
+
+/* The child has a single thread, so fresh locks are all it needs */
+void mm_fork_child(void)
+{
+    arena_t* h;
+    int i;
+
+    for(i = 0; i < MAX_ARENAS; i++)
+    {
+        if(arenas[i])
+            pthread_mutex_init(&arenas[i]->lock, NULL);
+    }
+    for(h = heaps; h; h = h->heapNext)
+        pthread_mutex_init(&h->lock, NULL);
+    pthread_mutex_init(&arenasLock, NULL);
+}
+
 
 int testmm_init()
 {
 
     int i = 0;
-    ////printf("Initial Heapsize is %zu\n",HeapSize);
+    ////printf("Initial Heapsize is %zu\n",arena->heapSize);
     for (i=0; i < NUM_BINS; i++)
     {
-        void* binPtr = HeapStart + WSIZE* i;        
+        void* binPtr = arena->heapStart + WSIZE* i;        
         if(GET(binPtr))
         {
             ////printf("Error initializing %d\n",i);
@@ -179,7 +794,7 @@ int testmm_init()
         }
 
     }
-    ////printf("Final Heapsize is %zu\n",HeapSize);
+    ////printf("Final Heapsize is %zu\n",arena->heapSize);
 }
 
 
@@ -196,7 +811,7 @@ void *coalesce(void *bp)
 {
 
 	
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
 	
@@ -219,9 +834,10 @@ void *coalesce(void *bp)
 
 		
 		removeFromFreeList(bpNext);		
+		arena->stats.coalesces++;
 		
 		//Update OH of final block
-		PUT(HDRP(bp), PACK(newSize, 0));
+		PUT(HDRP(bp), PACK(newSize, PREV_ALLOC));
         PUT(FTRP(bp), PACK(newSize, 0));
 	
 		
@@ -230,20 +846,20 @@ void *coalesce(void *bp)
 
     else if ((!prev_alloc) && (next_alloc)) { /* Case 3 */
 		
-		size_t prevSize = GET_SIZE(FTRP(PREV_BLKP(bp)));
+        void* bpPrev = PREV_BLKP(bp);
+		size_t prevSize = GET_SIZE(HDRP(bpPrev));
 		
 		size_t newSize;
-		
-        void* bpPrev = PREV_BLKP(bp);
 
 		newSize = size + prevSize;
 	
 		
 		removeFromFreeList(bpPrev);	
+		arena->stats.coalesces++;
 
 		//Update OH of final block
-		PUT(FTRP(bp), PACK(newSize, 0));
-        PUT(HDRP(bpPrev), PACK(newSize, 0));
+        PUT(HDRP(bpPrev), PACK(newSize, GET_PREV_ALLOC(HDRP(bpPrev))));
+		PUT(FTRP(bpPrev), PACK(newSize, 0));
 	 
 
 		return (bpPrev);
@@ -252,8 +868,8 @@ void *coalesce(void *bp)
     else{            /* Case 4 */
 		
 
-		size_t prevSize = GET_SIZE(HDRP(PREV_BLKP(bp)));
 		void* bpPrev = PREV_BLKP(bp);
+		size_t prevSize = GET_SIZE(HDRP(bpPrev));
 
 		size_t nextSize = GET_SIZE(HDRP(NEXT_BLKP(bp)));
 		void* bpNext = NEXT_BLKP(bp);
@@ -263,10 +879,11 @@ void *coalesce(void *bp)
 		//remove all from free list
 		removeFromFreeList(bpPrev);	
 		removeFromFreeList(bpNext);	
+		arena->stats.coalesces += 2;
 	
 		//Update OH of final block
-		PUT(HDRP(PREV_BLKP(bp)), PACK(newSize,0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(newSize,0));
+		PUT(HDRP(bpPrev), PACK(newSize, GET_PREV_ALLOC(HDRP(bpPrev))));
+        PUT(FTRP(bpPrev), PACK(newSize,0));
 	
         return (bpPrev);
     }
@@ -312,13 +929,38 @@ void addToFreeList(void* blockPointer)
 	size_t adjustedSize = GET_SIZE(HDRP(blockPointer));
 			
     int currIndex = getIndex(adjustedSize);
-    void* baseFromIndex = HeapStart + currIndex*WSIZE;
+    void* baseFromIndex = arena->heapStart + currIndex*WSIZE;
+
+    if(currIndex >= TREE_BIN)
+    {
+        treeInsert(blockPointer);
+        return;
+    }
     
     //////printf("location is %p\n",baseFromIndex);
     void* head = GET(baseFromIndex);
 
+#if FIT_POLICY == FIT_BEST
+    //Range bins stay sorted by size, then address, so the first fit is the best
+    if(currIndex >= NUM_SMALL_BINS && head && blockBefore(head, blockPointer))
+    {
+        void* prev = head;
+        void* next;
+        while((next = (void *)GET(prev+WSIZE)) && blockBefore(next, blockPointer))
+            prev = next;
+
+        PUT(blockPointer, (uintptr_t)prev);
+        PUT(blockPointer+WSIZE, (uintptr_t)next);
+        PUT(prev+WSIZE, (uintptr_t)blockPointer);
+        if(next)
+            PUT(next, (uintptr_t)blockPointer);
+        return;
+    }
+#endif
+
     //Change head in global segregated list
     PUT(baseFromIndex, blockPointer);
+    arena->binMap |= BIN_BIT(currIndex);
 
     //Change previous and next
     PUT(blockPointer+WSIZE, head);
@@ -342,45 +984,131 @@ void *extend_heap_init(size_t words) {
     /* Allocate an even number of words to maintain alignments */
     //size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
     size = words * WSIZE;
-    if ( (bp = mem_sbrk(size)) == (void *)-1 )
+    if ( (bp = arenaSbrk(size)) == (void *)-1 )
         return NULL;
 
-    HeapSize = HeapSize + size;
+    arena->heapSize = arena->heapSize + size;
     return bp;
 }
 
 
 /**********************************************************
  * extend_heap
- * Extend the heap by "words" words, maintaining alignment
- * requirements of course. Free the former epilogue block
- * and reallocate its new header
+ * Extend the top chunk by at least "words" words, maintaining
+ * alignment requirements of course, and return it
  **********************************************************/
 void *extend_heap(size_t words)
 {
-    char *bp;
     size_t size;
+    size_t have = arena->top ? GET_SIZE(HDRP(arena->top)) : 0;
 
     /* Allocate an even number of words to maintain alignments */
     size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ( (bp = mem_sbrk(size)) == (void *)-1 )
+    if(!topGrow(have + size))
         return NULL;
+    return arena->top;
+}
+
+/**********************************************************
+ * Top chunk
+ * The block before the epilogue is the arena's top chunk,
+ * the wilderness misses are carved from. It is marked
+ * allocated, so coalesce() never merges into it and it is
+ * never on a free list; releaseBlock() merges a free block
+ * that ends at the top into it instead. Only the top grows
+ * the heap, geometrically, and only trimTop() shrinks it.
+ * Its interior from arena->fresh up has never been written.
+ **********************************************************/
+
+/* Grow the top chunk to hold at least size bytes; 0 when the
+ * arena can't grow */
+int topGrow(size_t size)
+{
+    void* top = arena->top;
+    size_t have = top ? GET_SIZE(HDRP(top)) : 0;
+    size_t need = size - have;
+    size_t grow = MIN(MAX(arena->heapSize >> TOP_GROW_SHIFT, CHUNKSIZE), TOP_GROW_MAX);
+    void* bp;
+
+    grow = DSIZE * ((need + grow + DSIZE - 1) / DSIZE);
+    if((bp = arenaSbrk(grow)) == (void *)-1)
+    {
+        grow = DSIZE * ((need + DSIZE - 1) / DSIZE);
+        if((bp = arenaSbrk(grow)) == (void *)-1)
+            return 0;
+    }
 
-   // bp = bp + WSIZE;
+    if(top == NULL)
+    {
+        /* The old epilogue header becomes the top's header */
+        top = bp;
+        arena->top = top;
+    }
+    else if((char *)HDRP(bp) >= arena->fresh)
+    {
+        /* The old epilogue is inside the top now */
+        PUT(HDRP(bp), 0);
+    }
+    PUT(HDRP(top), PACK(have + grow, GET_PREV_ALLOC(HDRP(top)) | ALLOC));
+    PUT(HDRP(NEXT_BLKP(top)), PACK(0, ALLOC | PREV_ALLOC));
+    arena->heapSize += grow;
+    return 1;
+}
 
-    /* Initialize free block header/footer and the epilogue header */
-    PUT(HDRP(bp), PACK(size, 0));                // free block header
-    PUT(FTRP(bp), PACK(size, 0));                // free block footer
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));        // new epilogue header
+/* Split size bytes off the front of the top chunk, growing it
+ * first if needed, and return them as an allocated block. The
+ * block takes the whole top if what is left can't stand alone. */
+void *topTake(size_t size)
+{
+    void* bp = arena->top;
+    size_t have = bp ? GET_SIZE(HDRP(bp)) : 0;
+    void* rest;
 
-    /*Increment global counter*/
-    HeapSize = HeapSize + size;
+    if(have < size)
+    {
+        if(!topGrow(size))
+            return NULL;
+        bp = arena->top;
+        have = GET_SIZE(HDRP(bp));
+    }
 
-    /* Coalesce if the previous block was free */
-    //return coalesce(bp);
+    if(have - size < MIN_BLOCK)
+    {
+        arena->top = NULL;
+        rest = NEXT_BLKP(bp);
+    }
+    else
+    {
+        PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        rest = NEXT_BLKP(bp);
+        PUT(HDRP(rest), PACK(have - size, PREV_ALLOC | ALLOC));
+        arena->top = rest;
+    }
+    if((char *)rest > arena->fresh)
+        arena->fresh = rest;
     return bp;
 }
 
+/* File coalesced free block bp: at the end of the heap it joins
+ * the top chunk, anywhere else it goes on the free lists */
+void releaseBlock(void* bp)
+{
+    void* next = NEXT_BLKP(bp);
+    size_t size = GET_SIZE(HDRP(bp));
+
+    if(next != arena->top && GET_SIZE(HDRP(next)) != 0)
+    {
+        addToFreeList(bp);
+        return;
+    }
+
+    if(next == arena->top)
+        size += GET_SIZE(HDRP(next));
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+    SET_NEXT_PREV_ALLOC(bp);
+    arena->top = bp;
+}
+
 
 /**********************************************************
  * find_fit
@@ -391,7 +1119,7 @@ void *extend_heap(size_t words)
 void * find_fit(size_t asize)
 {
     void *bp;
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+    for (bp = arena->start + DSIZE; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
     {
         if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp))))
         {
@@ -411,9 +1139,9 @@ void place(void* bp, size_t asize)
     /* Get the current block size */
     size_t bsize = GET_SIZE(HDRP(bp));
 
-    /* Set allocated value to "used" */
-    PUT(HDRP(bp), PACK(bsize, 1));
-    PUT(FTRP(bp), PACK(bsize, 1));
+    /* Set allocated value to "used"; allocated blocks have no footer */
+    PUT(HDRP(bp), PACK(bsize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+    SET_NEXT_PREV_ALLOC(bp);
 }
 
 
@@ -421,66 +1149,43 @@ size_t getAdjustedSize(size_t size)
 {
     /* Adjust block size to include overhead and alignment reqs. */
     size_t asize;    
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
+    if (size <= MIN_BLOCK - OVERHEAD)
+        asize = MIN_BLOCK;
     else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1))/ DSIZE);
+        asize = DSIZE * ((size + (OVERHEAD) + (DSIZE-1))/ DSIZE);
 
     return asize;
 }
 
 
-int getIndex(size_t size){
-			//FINDS THE INDEX IN THE SEG LIST
-			int index = -100;
-			
-			if(size<=BIN_SIZE)
-				index= size/DSIZE -1;
-				
-			else if (size > BIN_SIZE && size <= 2*BIN_SIZE)
-				index=16;
-			else if (size > 2*BIN_SIZE && size <= 4*BIN_SIZE)
-				index=17;
-			else if (size > 4*BIN_SIZE && size <= 8*BIN_SIZE)
-				index=18;
-			else if (size > 8*BIN_SIZE && size <= 12*BIN_SIZE)
-				index=19;
-			else if (size > 12*BIN_SIZE && size <= 16*BIN_SIZE)
-				index=20;
-			else if (size > 16*BIN_SIZE && size <= 20*BIN_SIZE)
-				index=21;
-			else if (size > 20*BIN_SIZE && size <= 24*BIN_SIZE)
-				index=22;
-			else if (size > 24*BIN_SIZE && size <= 28*BIN_SIZE)
-				index=23;
-			else if (size > 28*BIN_SIZE && size <= 32*BIN_SIZE)
-				index=24;
-			else if (size > 32*BIN_SIZE && size <= 36*BIN_SIZE)
-				index=25;
-			else if (size > 36*BIN_SIZE && size <= 40*BIN_SIZE)
-				index=26;
-			else if (size > 40*BIN_SIZE && size <= 60*BIN_SIZE)
-				index=27;
-			else if (size > 60*BIN_SIZE && size <= 120*BIN_SIZE)
-				index=28;
-			else if (size > 120*BIN_SIZE && size <=200*BIN_SIZE)
-				index=29;
-			else if (size > 200*BIN_SIZE && size <=400*BIN_SIZE)
-				index=30;
-			else if (size > 400*BIN_SIZE && size <= 4000*BIN_SIZE)
-				index=31;
-			else
-				index=32;
-				
-			return index;
-	}
-			
+/**********************************************************
+ * getIndex
+ * Maps an adjusted block size to its bin in the segregated list.
+ * Blocks up to SMALL_BIN_MAX get an exact bin per DSIZE step;
+ * above that each power of two (2^k, 2^(k+1)] is split into
+ * SUB_BINS equal ranges, so the index falls out of a
+ * count-leading-zeros instead of a ladder of compares.
+ **********************************************************/
+int getIndex(size_t size)
+{
+    int index, log2;
+
+    if (size <= SMALL_BIN_MAX)
+        return size/DSIZE - 1;
+
+    log2 = FLOOR_LOG2(size - 1);
+    index = NUM_SMALL_BINS + ((log2 - SMALL_BIN_SHIFT) << SUB_BIN_SHIFT)
+          + (((size - 1) >> (log2 - SUB_BIN_SHIFT)) & (SUB_BINS - 1));
+    return (index < NUM_BINS) ? index : NUM_BINS - 1;
+}
+
 
 /**********************************************************
- * mm_free
+ * freeBlock
  * Free the block and coalesce with neighbouring blocks
+ * Caller must hold arena->lock
  **********************************************************/
-void mm_free(void *blockPointer)
+void freeBlock(void *blockPointer)
 {
    
     //////printf("Entering free\n");
@@ -488,17 +1193,31 @@ void mm_free(void *blockPointer)
         return;
     }
 
-    size_t adjustedSize = GET_SIZE(HDRP(blockPointer));
+    freeSpan(blockPointer, GET_SIZE(HDRP(blockPointer)), 1);
+}
 
-    ////printf("Size to free is %zu\n",adjustedSize);
-    PUT(HDRP(blockPointer), PACK(adjustedSize,0));
-    PUT(FTRP(blockPointer), PACK(adjustedSize,0));
-	////printf ("Before coalescing %zu \n", GET_SIZE(HDRP(blockPointer)));
-    blockPointer = coalesce(blockPointer);
-	//////printf ("AFTER COALESCING BIATCHES ............................\n");
-	//////printf ("After coalescing %zu \n", GET_SIZE(HDRP(blockPointer)));
-	addToFreeList(blockPointer);
-	
+/**********************************************************
+ * freeSpan
+ * Free the size bytes of back to back allocated blocks that
+ * start at bp as one block: a single coalesce and list insert
+ * however many blocks it covers.
+ * Caller must hold arena->lock
+ **********************************************************/
+void freeSpan(void* bp, size_t size, unsigned int blocks)
+{
+    updateOH(bp, size);
+    CLEAR_NEXT_PREV_ALLOC(bp);
+    bp = coalesce(bp);
+	releaseBlock(bp);
+
+	arena->freeOps += blocks;
+	if(arena->freeOps >= PURGE_INTERVAL)
+	{
+		arena->freeOps = 0;
+		arena->purgeEpoch++;
+		if(arena->purgeEpoch > PURGE_DECAY)
+			purgeTree(arena->treeRoot, arena->purgeEpoch - PURGE_DECAY);
+	}
 }
 
 
@@ -535,43 +1254,52 @@ void testFree()
 
 
 /**********************************************************
- * mm_malloc
- * Allocate a block of size bytes.
- * The type of search is determined by find_fit
+ * mallocBlock
+ * Allocate a block of adjustedSize bytes from the shared heap.
+ * The type of search is determined by getBestFit
  * The decision of splitting the block, or not is determined
- *   in place(..)
+ *   in split(..)
  * If no block satisfies the request, the heap is extended
+ * Caller must hold arena->lock
  **********************************************************/
-
-
-void *mm_malloc(size_t size)
+void *mallocBlock(size_t adjustedSize)
 {
-
-    size_t adjustedSize; /* adjusted block size */
-    size_t extendsize; /* amount to extend heap if no fit */
-    char * bp;
     int currIndex = 0;
-    void* baseOfIndex;
+    uint64_t largerBins;
     char* assignedBlock = NULL;
 
-    /* Ignore spurious requests */
-    if (size == 0)
-        return NULL;
+    if(adjustedSize <= QUICK_MAX && arena->quick[QUICK_INDEX(adjustedSize)])
+        return quickPop(QUICK_INDEX(adjustedSize));
 
     /* Search the free list for a fit */
-
-    adjustedSize = getAdjustedSize(size);
     currIndex = getIndex(adjustedSize); 
 
-    while((!assignedBlock) && (currIndex < NUM_BINS))
+    /* The home bin may hold blocks smaller than the request */
+    if(arena->binMap & BIN_BIT(currIndex))
     {
-        baseOfIndex = HeapStart + currIndex*WSIZE;
-        if(GET(baseOfIndex))
-        {
-            assignedBlock = getBestFit(baseOfIndex,adjustedSize,currIndex);
-        }
-        currIndex++;
-    }   
+        assignedBlock = getBestFit(arena->heapStart + currIndex*WSIZE,adjustedSize,currIndex);
+    }
+
+    /* Any block in a higher bin fits, so search only the first one */
+    largerBins = arena->binMap & ~((BIN_BIT(currIndex) << 1) - 1);
+    if((!assignedBlock) && largerBins)
+    {
+        currIndex = __builtin_ctzll(largerBins);
+        assignedBlock = getBestFit(arena->heapStart + currIndex*WSIZE,adjustedSize,currIndex);
+    }
+
+    /* Large blocks are never in a list bin, so fall back to the tree */
+    if((!assignedBlock) && arena->treeRoot && (assignedBlock = treeBestFit(adjustedSize)))
+    {
+        assignedBlock = split(assignedBlock,adjustedSize);
+    }
+
+    /* A miss: merge the quick lists and search once more */
+    if(!assignedBlock && arena->quickBytes)
+    {
+        quickConsolidate();
+        return mallocBlock(adjustedSize);
+    }
 
     if(!assignedBlock)
     {
@@ -615,7 +1343,7 @@ void testMalloc()
     if(bp)
     {
         int currIndex = getIndex(adjustedSize);
-        baseOfIndex = currIndex*WSIZE + HeapStart;
+        baseOfIndex = currIndex*WSIZE + arena->heapStart;
         PUT(baseOfIndex,bp);
     }
     else
@@ -628,7 +1356,7 @@ void testMalloc()
     if(bp2)
     {
         int currIndex = getIndex(adjustedSize2);
-        baseOfIndex = currIndex*WSIZE + HeapStart;
+        baseOfIndex = currIndex*WSIZE + arena->heapStart;
         PUT(GET(baseOfIndex)+WSIZE,bp2);
         PUT(bp2,GET(baseOfIndex));
     }
@@ -655,14 +1383,14 @@ void* split (void* mainBlock, size_t adjustedSize)
 
 	removeFromFreeList(mainBlock);
   
-    if(mainSize -adjustedSize<32)
+    if(mainSize -adjustedSize<MIN_BLOCK)
     {
 		
         return mainBlock;
     }
     
 
-	if(mainSize-adjustedSize>=32)
+	if(mainSize-adjustedSize>=MIN_BLOCK)
 	{
 		size_t remSize = mainSize - adjustedSize;
 		size_t wantedPayLoad = adjustedSize - DSIZE;
@@ -678,7 +1406,11 @@ void* split (void* mainBlock, size_t adjustedSize)
 		PUT(HDRP(wantBlock),PACK(adjustedSize,0));*/
 		
 		updateOH(wantBlock,adjustedSize);
-		updateOH(remBlock,remSize);
+		arena->stats.splits++;
+
+		//the caller places wantBlock, so the remainder follows an allocated block
+		PUT(HDRP(remBlock), PACK(remSize, PREV_ALLOC));
+		PUT(FTRP(remBlock), PACK(remSize, 0));
 
 		
 		//addToFreeList(wantBlock);
@@ -722,10 +1454,10 @@ void testSplit()
 
 void updateOH(void* blockPointer,size_t adjustedSize)
 {
-    /* Set allocated value to "unused" */
+    /* Set allocated value to "unused", keeping the PREV_ALLOC bit */
 
 	
-    PUT(HDRP(blockPointer), PACK(adjustedSize, 0));
+    PUT(HDRP(blockPointer), PACK(adjustedSize, GET_PREV_ALLOC(HDRP(blockPointer))));
     PUT(FTRP(blockPointer), PACK(adjustedSize, 0));
 }
 
@@ -737,6 +1469,12 @@ void removeFromFreeList(void* blockPointer)
         return; 
     }
 
+    if(getIndex(GET_SIZE(HDRP(blockPointer))) >= TREE_BIN)
+    {
+        treeRemove(blockPointer);
+        return;
+    }
+
     void* prev = GET(blockPointer);
     void* next = GET(blockPointer+WSIZE);
 	
@@ -760,8 +1498,10 @@ void removeFromFreeList(void* blockPointer)
         //calculate currIndex
         size_t size = GET_SIZE(HDRP(blockPointer));
         int currIndex = getIndex(size);
-        void* baseOfIndex = currIndex*WSIZE + HeapStart;
+        void* baseOfIndex = currIndex*WSIZE + arena->heapStart;
         PUT(baseOfIndex,next);
+        if(next==NULL)
+            arena->binMap &= ~BIN_BIT(currIndex);
     }
 
 }
@@ -771,67 +1511,483 @@ void addFreeList(void* blockPointer)
     mm_free(blockPointer);
 }
 
-/***********************************************************
- * Re written implementation of find_fit()
- * Uses first fit to check each bin for the required size block
- * getBestFit
- *
+/**********************************************************
+ * Large free block tree
+ * Free blocks above TREE_MIN are kept in a red-black tree
+ * ordered by size, then address, with the links in the
+ * block's payload. Insert, remove and best-fit lookup are
+ * O(log n); the parent link lets coalesce() unlink a
+ * neighbour without searching for it.
  **********************************************************/
-void *getBestFit(void* baseOfIndex,size_t adjustedSize,int currIndex)
-{
 
+/* Point parent's link to old at new instead */
+void treeReplaceChild(void* parent, void* old, void* new)
+{
+    if(parent == NULL)
+        arena->treeRoot = new;
+    else if(TREE_LEFT(parent) == old)
+        TREE_LEFT(parent) = new;
+    else
+        TREE_RIGHT(parent) = new;
+}
 
-	void* currentHead = GET(baseOfIndex);
-	
-		while(currentHead)
-		{
-			if(adjustedSize <=GET_SIZE(HDRP(currentHead)))			
-			{
-				void* splitPointer = split(currentHead,adjustedSize);
-				return splitPointer;
-			}
-			currentHead = GET(currentHead+WSIZE);
-		}	
-
-	return NULL;
+void treeRotateLeft(void* x)
+{
+    void* y = TREE_RIGHT(x);
+
+    TREE_RIGHT(x) = TREE_LEFT(y);
+    if(TREE_LEFT(y))
+        TREE_PARENT(TREE_LEFT(y)) = x;
+    TREE_PARENT(y) = TREE_PARENT(x);
+    treeReplaceChild(TREE_PARENT(x), x, y);
+    TREE_LEFT(y) = x;
+    TREE_PARENT(x) = y;
+}
 
+void treeRotateRight(void* x)
+{
+    void* y = TREE_LEFT(x);
+
+    TREE_LEFT(x) = TREE_RIGHT(y);
+    if(TREE_RIGHT(y))
+        TREE_PARENT(TREE_RIGHT(y)) = x;
+    TREE_PARENT(y) = TREE_PARENT(x);
+    treeReplaceChild(TREE_PARENT(x), x, y);
+    TREE_RIGHT(y) = x;
+    TREE_PARENT(x) = y;
+}
 
-	
-} 
-/***********************************************************
- *Unit Test for getBestFit()
- ***********************************************************/
+void treeInsert(void* bp)
+{
+    void* parent = NULL;
+    void** link = &arena->treeRoot;
+    void* grand;
+    void* uncle;
 
+    while(*link)
+    {
+        parent = *link;
+        link = blockBefore(bp, parent) ? &TREE_LEFT(parent) : &TREE_RIGHT(parent);
+    }
+    TREE_LEFT(bp) = NULL;
+    TREE_RIGHT(bp) = NULL;
+    TREE_PARENT(bp) = parent;
+    TREE_COLOR(bp) = RED;
+    TREE_STAMP(bp) = arena->purgeEpoch;
+    *link = bp;
+
+    /* Restore the red-black properties on the way up */
+    while((parent = TREE_PARENT(bp)) && TREE_COLOR(parent) == RED)
+    {
+        grand = TREE_PARENT(parent);
+        if(parent == TREE_LEFT(grand))
+        {
+            uncle = TREE_RIGHT(grand);
+            if(IS_RED(uncle))
+            {
+                TREE_COLOR(parent) = BLACK;
+                TREE_COLOR(uncle) = BLACK;
+                TREE_COLOR(grand) = RED;
+                bp = grand;
+                continue;
+            }
+            if(bp == TREE_RIGHT(parent))
+            {
+                treeRotateLeft(parent);
+                bp = parent;
+                parent = TREE_PARENT(bp);
+            }
+            TREE_COLOR(parent) = BLACK;
+            TREE_COLOR(grand) = RED;
+            treeRotateRight(grand);
+        }
+        else
+        {
+            uncle = TREE_LEFT(grand);
+            if(IS_RED(uncle))
+            {
+                TREE_COLOR(parent) = BLACK;
+                TREE_COLOR(uncle) = BLACK;
+                TREE_COLOR(grand) = RED;
+                bp = grand;
+                continue;
+            }
+            if(bp == TREE_LEFT(parent))
+            {
+                treeRotateRight(parent);
+                bp = parent;
+                parent = TREE_PARENT(bp);
+            }
+            TREE_COLOR(parent) = BLACK;
+            TREE_COLOR(grand) = RED;
+            treeRotateLeft(grand);
+        }
+    }
+    TREE_COLOR(arena->treeRoot) = BLACK;
+}
 
-void testGetBestFit()
+/* Replace the subtree at u with the one at v */
+void treeTransplant(void* u, void* v)
 {
-    size_t adjustedSize = 32;
-    size_t adjustedSize2 = 32;
+    treeReplaceChild(TREE_PARENT(u), u, v);
+    if(v)
+        TREE_PARENT(v) = TREE_PARENT(u);
+}
 
-    char* bp;
-    char* bp2;
-    void* baseOfIndex;
-    void* testIndex;
+void treeRemove(void* bp)
+{
+    void* x;
+    void* parent;
+    void* sibling;
+    void* y = bp;
+    uintptr_t removedColor = TREE_COLOR(bp);
 
-    bp = extend_heap(adjustedSize/WSIZE);
-    if(bp)
+    if(TREE_LEFT(bp) == NULL || TREE_RIGHT(bp) == NULL)
     {
-        int currIndex = getIndex(adjustedSize);
-        baseOfIndex = currIndex*WSIZE + HeapStart;
-        PUT(baseOfIndex,bp);
+        x = TREE_LEFT(bp) ? TREE_LEFT(bp) : TREE_RIGHT(bp);
+        parent = TREE_PARENT(bp);
+        treeTransplant(bp, x);
     }
     else
     {
-        printf("extend heap failed\n");
-        return;
+        /* Splice in the successor, the leftmost node on the right */
+        for(y = TREE_RIGHT(bp); TREE_LEFT(y); y = TREE_LEFT(y))
+            ;
+        removedColor = TREE_COLOR(y);
+        x = TREE_RIGHT(y);
+        if(TREE_PARENT(y) == bp)
+        {
+            parent = y;
+        }
+        else
+        {
+            parent = TREE_PARENT(y);
+            treeTransplant(y, x);
+            TREE_RIGHT(y) = TREE_RIGHT(bp);
+            TREE_PARENT(TREE_RIGHT(y)) = y;
+        }
+        treeTransplant(bp, y);
+        TREE_LEFT(y) = TREE_LEFT(bp);
+        TREE_PARENT(TREE_LEFT(y)) = y;
+        TREE_COLOR(y) = TREE_COLOR(bp);
     }
 
-    bp2 = extend_heap(adjustedSize2/WSIZE);
-    if(bp2)
-    {
-        int currIndex = getIndex(adjustedSize2);
-        baseOfIndex = currIndex*WSIZE + HeapStart;
-        void* head = GET(baseOfIndex);
+    if(removedColor == RED)
+        return;
+
+    /* x carries an extra black; push it up or resolve it */
+    while(x != arena->treeRoot && !IS_RED(x))
+    {
+        if(x == TREE_LEFT(parent))
+        {
+            sibling = TREE_RIGHT(parent);
+            if(IS_RED(sibling))
+            {
+                TREE_COLOR(sibling) = BLACK;
+                TREE_COLOR(parent) = RED;
+                treeRotateLeft(parent);
+                sibling = TREE_RIGHT(parent);
+            }
+            if(!IS_RED(TREE_LEFT(sibling)) && !IS_RED(TREE_RIGHT(sibling)))
+            {
+                TREE_COLOR(sibling) = RED;
+                x = parent;
+                parent = TREE_PARENT(x);
+                continue;
+            }
+            if(!IS_RED(TREE_RIGHT(sibling)))
+            {
+                TREE_COLOR(TREE_LEFT(sibling)) = BLACK;
+                TREE_COLOR(sibling) = RED;
+                treeRotateRight(sibling);
+                sibling = TREE_RIGHT(parent);
+            }
+            TREE_COLOR(sibling) = TREE_COLOR(parent);
+            TREE_COLOR(parent) = BLACK;
+            TREE_COLOR(TREE_RIGHT(sibling)) = BLACK;
+            treeRotateLeft(parent);
+        }
+        else
+        {
+            sibling = TREE_LEFT(parent);
+            if(IS_RED(sibling))
+            {
+                TREE_COLOR(sibling) = BLACK;
+                TREE_COLOR(parent) = RED;
+                treeRotateRight(parent);
+                sibling = TREE_LEFT(parent);
+            }
+            if(!IS_RED(TREE_LEFT(sibling)) && !IS_RED(TREE_RIGHT(sibling)))
+            {
+                TREE_COLOR(sibling) = RED;
+                x = parent;
+                parent = TREE_PARENT(x);
+                continue;
+            }
+            if(!IS_RED(TREE_LEFT(sibling)))
+            {
+                TREE_COLOR(TREE_RIGHT(sibling)) = BLACK;
+                TREE_COLOR(sibling) = RED;
+                treeRotateLeft(sibling);
+                sibling = TREE_LEFT(parent);
+            }
+            TREE_COLOR(sibling) = TREE_COLOR(parent);
+            TREE_COLOR(parent) = BLACK;
+            TREE_COLOR(TREE_LEFT(sibling)) = BLACK;
+            treeRotateRight(parent);
+        }
+        x = arena->treeRoot;
+    }
+    if(x)
+        TREE_COLOR(x) = BLACK;
+}
+
+/**********************************************************
+ * Quick lists
+ * Frees of blocks up to QUICK_MAX skip coalesce() and land on
+ * a LIFO of their exact size, still marked allocated and linked
+ * through the first payload word like the thread caches. A
+ * request of that size pops one back with no search or split.
+ * quickConsolidate frees them for real, so neighbours merge,
+ * once they pass QUICK_BUDGET or a request misses everything.
+ * All of it runs with arena->lock held.
+ **********************************************************/
+void quickPush(void* bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    int index = QUICK_INDEX(size);
+
+    PUT(bp, (uintptr_t)arena->quick[index]);
+    arena->quick[index] = bp;
+    arena->quickBytes += size;
+    if(arena->quickBytes > QUICK_BUDGET)
+        quickConsolidate();
+}
+
+void *quickPop(int index)
+{
+    void* bp = arena->quick[index];
+
+    arena->quick[index] = (void *)GET(bp);
+    arena->quickBytes -= GET_SIZE(HDRP(bp));
+    return bp;
+}
+
+void quickConsolidate(void)
+{
+    void* bp;
+    void* next;
+    int i;
+
+    for(i = 0; i < QUICK_LISTS; i++)
+    {
+        for(bp = arena->quick[i]; bp; bp = next)
+        {
+            next = (void *)GET(bp);
+            freeBlock(bp);
+        }
+        arena->quick[i] = NULL;
+    }
+    arena->quickBytes = 0;
+}
+
+/**********************************************************
+ * Purging
+ * Hands free memory back to the OS, either from freeBlock()
+ * on the PURGE_INTERVAL decay clock or all at once from
+ * mm_trim(). The pages inside a large free block are purged
+ * in place, keeping its header, tree node and footer. The
+ * decay pass never moves the break, so the heap size stays a
+ * high-water mark; mm_trim() also releases the top chunk of
+ * each arena through arenaSbrk.
+ **********************************************************/
+
+/* Purge the whole pages inside free tree block bp */
+size_t purgeBlock(void* bp)
+{
+    uintptr_t page = mem_pagesize();
+    uintptr_t start = ((uintptr_t)bp + TREE_NODE + page - 1) & ~(page - 1);
+    uintptr_t end = (uintptr_t)FTRP(bp) & ~(page - 1);
+
+    TREE_STAMP(bp) = PURGED;
+    if(end <= start)
+        return 0;
+    mem_purge((void *)start, end - start);
+    return end - start;
+}
+
+/* Purge every unpurged block of the subtree freed before epoch before */
+size_t purgeTree(void* node, uintptr_t before)
+{
+    size_t purged = 0;
+
+    if(node == NULL)
+        return 0;
+    if(GET_SIZE(HDRP(node)) >= PURGE_MIN && TREE_STAMP(node) < before)
+        purged = purgeBlock(node);
+    purged += purgeTree(TREE_LEFT(node), before);
+    return purged + purgeTree(TREE_RIGHT(node), before);
+}
+
+/* Give the top chunk back through arenaSbrk */
+size_t trimTop(void)
+{
+    void* top = arena->top;
+    char* end;
+    size_t size;
+
+    if(top == NULL)
+        return 0;
+    size = GET_SIZE(HDRP(top));
+
+    /* Only whole pages are purged, so the epilogue would survive
+     * above fresh whenever it shares a page with the new break and
+     * a later calloc would hand it out unzeroed */
+    end = HDRP(NEXT_BLKP(top));
+    PUT(end, 0);
+    if(arenaSbrk(-(intptr_t)size) == (void *)-1)
+    {
+        PUT(end, PACK(0, ALLOC | PREV_ALLOC));
+        return 0;
+    }
+
+    PUT(HDRP(top), PACK(0, ALLOC | GET_PREV_ALLOC(HDRP(top))));
+    arena->top = NULL;
+    arena->heapSize -= size;
+    return size;
+}
+
+/**********************************************************
+ * mm_trim
+ * Return as much free memory to the OS as possible right now,
+ * ignoring the decay schedule. Returns the bytes released.
+ **********************************************************/
+size_t mm_trim(void)
+{
+    arena_t* all[MAX_ARENAS];
+    size_t released = 0;
+    int i;
+
+    pthread_mutex_lock(&arenasLock);
+    memcpy(all, arenas, sizeof(all));
+    pthread_mutex_unlock(&arenasLock);
+
+    for(i = 0; i < MAX_ARENAS; i++)
+    {
+        if(all[i] == NULL)
+            continue;
+        arenaLock(all[i]);
+        arenaDrain();
+        quickConsolidate();
+        released += trimTop();
+        released += purgeTree(arena->treeRoot, PURGED);
+        arenaUnlock();
+    }
+    return released;
+}
+
+/* Smallest free block of at least adjustedSize bytes, or NULL */
+void *treeBestFit(size_t adjustedSize)
+{
+    void* node = arena->treeRoot;
+    void* fit = NULL;
+    size_t examined = 0;
+
+    while(node)
+    {
+        examined++;
+        if(GET_SIZE(HDRP(node)) >= adjustedSize)
+        {
+            fit = node;
+            node = TREE_LEFT(node);
+        }
+        else
+        {
+            node = TREE_RIGHT(node);
+        }
+    }
+    statsFit(examined);
+    return fit;
+}
+
+/***********************************************************
+ * Re written implementation of find_fit()
+ * getBestFit
+ * Searches one bin for the required size block, per FIT_POLICY:
+ * - FIT_FIRST takes the first block that is big enough
+ * - FIT_BEST keeps range bins sorted, so the first fit is the
+ *   smallest one and the scan stops there
+ * - FIT_GOOD examines at most GOOD_FIT_CANDIDATES blocks and
+ *   keeps the smallest that fits, stopping early on an exact fit
+ **********************************************************/
+void *getBestFit(void* baseOfIndex,size_t adjustedSize,int currIndex)
+{
+
+
+	void* currentHead = (void *)GET(baseOfIndex);
+	void* fit = NULL;
+	size_t fitSize = 0;
+	size_t examined = 0;
+	
+		while(currentHead)
+		{
+			size_t size = GET_SIZE(HDRP(currentHead));
+			examined++;
+			if(adjustedSize <= size)			
+			{
+				if(!fit || size < fitSize)
+				{
+					fit = currentHead;
+					fitSize = size;
+				}
+				if(FIT_POLICY != FIT_GOOD || size == adjustedSize)
+					break;
+			}
+			if(FIT_POLICY == FIT_GOOD && examined >= GOOD_FIT_CANDIDATES)
+				break;
+			currentHead = (void *)GET(currentHead+WSIZE);
+		}	
+
+	statsFit(examined);
+	return fit ? split(fit,adjustedSize) : NULL;
+
+
+	
+} 
+/***********************************************************
+ *Unit Test for getBestFit()
+ ***********************************************************/
+
+
+void testGetBestFit()
+{
+    size_t adjustedSize = 32;
+    size_t adjustedSize2 = 32;
+
+    char* bp;
+    char* bp2;
+    void* baseOfIndex;
+    void* testIndex;
+
+    bp = extend_heap(adjustedSize/WSIZE);
+    if(bp)
+    {
+        int currIndex = getIndex(adjustedSize);
+        baseOfIndex = currIndex*WSIZE + arena->heapStart;
+        PUT(baseOfIndex,bp);
+    }
+    else
+    {
+        printf("extend heap failed\n");
+        return;
+    }
+
+    bp2 = extend_heap(adjustedSize2/WSIZE);
+    if(bp2)
+    {
+        int currIndex = getIndex(adjustedSize2);
+        baseOfIndex = currIndex*WSIZE + arena->heapStart;
+        void* head = GET(baseOfIndex);
 
         PUT(head+WSIZE,bp2);
         PUT(bp2,head);
@@ -849,193 +2005,1620 @@ void testGetBestFit()
 
 void *extendHeapAndAlloc(size_t adjustedSize)
 {
-    /*If block not found in free list extend the heap*/
-    size_t extendsize;
-    extendsize = MAX(adjustedSize, CHUNKSIZE);
-
-    char* bp; //block pointer
-    if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
-        return NULL;
-    return bp;
+    /*If block not found in free list carve it from the top chunk*/
+    return topTake(adjustedSize);
 }
 
 /******************************************************************* 
- * mm_realloc()
+ * reallocBlock()
  * More efficient than previous implementation due to coalescing with
  * next block and splitting in case of excess space.
+ * Growth stays in place when possible: into a free next block, by
+ * extending the heap when the block is last, or by sliding into a
+ * free previous block. Only then is the payload copied elsewhere.
+ * Caller must hold arena->lock
  ********************************************************************/
-void *mm_realloc(void *ptr, size_t size)
+void *reallocBlock(void *ptr, size_t size)
 	{	
+		void* newptr;
 
 		if (size == 0){
-			mm_free(ptr);
+			heapFree(ptr);
 			return NULL;
 		}
+		if (size > MAX_REQUEST)
+			return NULL;
 
-	
-    // if old is null, this is the same as malloc
+		// if old is null, this is the same as malloc
+		if(ptr==NULL)
+			return (heapAlloc(size));
 
-	if(ptr==NULL)
-		return (mm_malloc(size));
+		if(isSlabPointer(ptr)){
+			size_t slotSize = SLAB_RUN(ptr)->slotSize;
+			if(size <= slotSize)
+				return ptr;
+			if((newptr = heapAlloc(size)) == NULL)
+				return NULL;
+			memcpy(newptr, ptr, slotSize);
+			slabFree(ptr);
+			return newptr;
+		}
 
 		void* oldptr = ptr;
-		void* newptr;
 		size_t oldSize = GET_SIZE(HDRP(oldptr));
-		size_t asize = size + DSIZE;
-		//diff between new and old size is 32
-		if(asize < oldSize && (oldSize -(asize)) > 4*WSIZE){
-			size = getAdjustedSize(size);
-
-			//SPLIT THE BLOCK
-
-			size_t remSize =  GET_SIZE(HDRP(ptr)) - size;
-		    size_t wantedPayLoad = size - DSIZE;
-		
-		    void* wantBlock = ptr;
-		    void* remBlock = ptr  + wantedPayLoad + DSIZE;
-			updateOH(ptr,size);
-			updateOH(remBlock,remSize);
-            place(ptr,size);
-			addToFreeList(remBlock);
+		size_t asize = getAdjustedSize(size);
+		size_t reserve = asize;
+
+		//track a run of growths on the same block
+		if(ptr == arena->growPtr && size > arena->growSize)
+			arena->growSteps++;
+		else
+			arena->growSteps = 0;
+		arena->growPtr = ptr;
+		arena->growSize = size;
+		if(arena->growSteps >= GROW_STREAK)
+			reserve = (asize + (asize >> GROW_SHIFT)) & ~(DSIZE - 1);
+
+		//shrinking, or the slack already covers it: split off what is left
+		if(asize <= oldSize){
+			if(arena->growSteps < GROW_STREAK)
+				trimBlock(ptr, asize);
 			return ptr;
 		}
-		//if we cant split then just return oldptr
-		else if (asize < oldSize && !((oldSize-(asize))>(4*WSIZE)))
-				return oldptr;
 		else {
-			size = getAdjustedSize(size);
 			void* next_block = NEXT_BLKP(ptr);
-
-			int totalSize = GET_SIZE(HDRP(ptr)) + GET_SIZE(HDRP(next_block));
+			size_t nextSize = GET_ALLOC(HDRP(next_block)) ? 0 : GET_SIZE(HDRP(next_block));
+			size_t totalSize = oldSize + nextSize;
 
 			//if block is free
-			if(!GET_ALLOC(HDRP(next_block)))
+			if(nextSize && totalSize >= asize)
 			{
+				//coaleasce with next block only, then split if possible
+				removeFromFreeList(next_block);
+				PUT(HDRP(ptr), PACK(totalSize, GET(HDRP(ptr)) & (ALLOC | PREV_ALLOC)));
+				SET_NEXT_PREV_ALLOC(ptr);
+				trimBlock(ptr, MIN(reserve, totalSize));
+				return ptr;
+			}
 
-				if (totalSize >= size){
-					//coaleasce with next block only
-					
-					removeFromFreeList(NEXT_BLKP(ptr));
-					PUT(HDRP(ptr), PACK( totalSize, 0));
-					PUT(FTRP(ptr), PACK( totalSize, 0));
-
-					if(totalSize - size > 4*WSIZE){
-					//split if possible
-						 size_t remSize =  totalSize - size;
-		                 size_t wantedPayLoad = size - DSIZE;
-		
-		                 void* wantBlock = ptr;
-		                 void* remBlock =ptr  + wantedPayLoad + DSIZE;
-						 updateOH(ptr,size);
-						 updateOH(remBlock,remSize);
-                         place(ptr,size);
-					     addToFreeList(remBlock);
-						 return wantBlock;
-					}
-				  else {
-				  //could not split so just return the block
-					  place(ptr,size);
-					  return ptr;
-				  }
-          
-               }
-
+			//next to the top chunk: take just the shortfall from it
+			if((next_block == arena->top || GET_SIZE(HDRP(next_block)) == 0)
+			   && topTake(asize - oldSize) != NULL)
+			{
+				PUT(HDRP(ptr), PACK(oldSize + GET_SIZE(HDRP(next_block)), GET(HDRP(ptr)) & (ALLOC | PREV_ALLOC)));
+				return ptr;
+			}
 
+			//absorb a free previous block too and slide the payload down
+			if(!GET_PREV_ALLOC(HDRP(ptr)))
+			{
+				void* prev_block = PREV_BLKP(ptr);
+				size_t prevSize = GET_SIZE(HDRP(prev_block));
+
+				if(prevSize + totalSize >= asize)
+				{
+					removeFromFreeList(prev_block);
+					if(nextSize)
+						removeFromFreeList(next_block);
+					memmove(prev_block, ptr, oldSize - OVERHEAD);
+					PUT(HDRP(prev_block), PACK(prevSize + totalSize, GET_PREV_ALLOC(HDRP(prev_block)) | ALLOC));
+					SET_NEXT_PREV_ALLOC(prev_block);
+					trimBlock(prev_block, MIN(reserve, prevSize + totalSize));
+					arena->growPtr = prev_block;
+					return prev_block;
+				}
 			}
 		}
 		
 		// coalescing does not give enough size, so need to memcpy instead
+		// asking for reserve payload bytes leaves at least the header's
+		// worth of slack that lets the next small growth stay in place
 
-           newptr = mm_malloc(size);
+           newptr = heapAlloc(reserve);
 			if (newptr ==NULL)
 				return NULL;
-			oldSize = GET_SIZE(HDRP(oldptr));
+			arena->growPtr = newptr;
+			oldSize -= OVERHEAD;
 			if(size < oldSize)
 				oldSize=size;
 			memcpy(newptr, oldptr, oldSize);
-            mm_free(oldptr);
+            freeBlock(oldptr);
 			return newptr;
     }
 
 /**********************************************************
- * mm_check
- * Check the consistency of the memory heap
- * Return nonzero if the heap is consistant.
- *********************************************************/
- 
-/****** Heap checker helper header****************/
-int isInFreeList(void* bp, int currIndex);
+ * trimBlock
+ * Shrink allocated block bp to asize bytes when the tail is
+ * big enough to stand alone, and free the tail
+ **********************************************************/
+void trimBlock(void* bp, size_t asize)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    void* rem;
+
+    if(size - asize < MIN_BLOCK)
+        return;
+
+    PUT(HDRP(bp), PACK(asize, GET(HDRP(bp)) & (ALLOC | PREV_ALLOC)));
+    rem = NEXT_BLKP(bp);
+    PUT(HDRP(rem), PACK(size - asize, PREV_ALLOC));
+    PUT(FTRP(rem), PACK(size - asize, 0));
+    CLEAR_NEXT_PREV_ALLOC(rem);
+    releaseBlock(coalesce(rem));
+}
+
+/**********************************************************
+ * Slab runs
+ * Requests of SLAB_MAX bytes or less are carved from RUN_SIZE
+ * runs of equal slots with no per-slot header or footer. A run
+ * is an ordinary allocated block whose payload is RUN_SIZE-aligned,
+ * so a slot finds its run by masking the address, and the arena's runMap
+ * tells slab pointers apart from block pointers in free().
+ * Slots never reach coalesce() or the segregated list.
+ **********************************************************/
 
-int mm_check()
+/* Route a request to a slab, the block heap or its own mapping; arena->lock held */
+void *heapAlloc(size_t size)
 {
+    void* bp;
 
-	//Is every block in the free list marked as free?
+    if(size <= SLAB_MAX && (bp = slabAlloc(size)) != NULL)
+        return bp;
+    if(size >= mmapThreshold && !arena->isHeap)
+        return hugeAlloc(size);
+    return mallocBlock(getAdjustedSize(size));
+}
 
-	int currIndex;
+/* Free any kind of pointer, or nothing for NULL; arena->lock held */
+void heapFree(void *ptr)
+{
+    if(ptr == NULL)
+        return;
+    if(isSlabPointer(ptr))
+        slabFree(ptr);
+    else if(GET(HDRP(ptr)) & MMAPPED)
+        hugeFree(ptr);
+    else if(GET_SIZE(HDRP(ptr)) <= QUICK_MAX)
+        quickPush(ptr);
+    else
+        freeBlock(ptr);
+}
 
-	for(currIndex=0;currIndex< NUM_BINS; currIndex++)
-	{
-		
-		void* baseFromIndex = HeapStart + currIndex*WSIZE;
-		void* head = GET(baseFromIndex);
+/* Distance from bp to the first align boundary that leaves room
+ * for a free block in front */
+size_t alignedLead(void* bp, size_t align)
+{
+    size_t lead = -(uintptr_t)bp & (align - 1);
 
-		while(head)
-		{
-			if (GET_ALLOC(HDRP(head))!=0)
-			{
-				return -1;
-			}
+    if(lead != 0 && lead < MIN_BLOCK)
+        lead += align;
+    return lead;
+}
 
-			size_t prev_alloc = GET_ALLOC(HDRP(PREV_BLKP(head)));
-			size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(head)));
-			
-			if(prev_alloc==0 || next_alloc==0)
-			{	
-				//escaped coalescing
-				printf("Escaped coalescing?\n");
-				return -1;
-			}
-            
-            if((head < HeapStart) || (head > (HeapStart+HeapSize)))
-            {
-                //Not a valid heap address
-                printf("Not a valid heap address?\n");
-                return -1;
-            }
-			head = GET(head);
-		}
-	}
+/* A free block with room for asize bytes at an align boundary,
+ * or NULL after ALIGN_CANDIDATES misses */
+void *alignedFit(size_t align, size_t asize)
+{
+    uint64_t bins = arena->binMap & ~(BIN_BIT(getIndex(asize)) - 1);
+    int candidates = 0;
+    void* bp;
 
-	//Is every free block actually in the free list?
-	void* memStart = HeapStart + (NUM_BINS+1)*WSIZE;
-	while(memStart)
-	{
-        size_t alloc = GET_ALLOC(HDRP(memStart));
-        if(!alloc)
-		{
-            currIndex = getIndex(memStart);
-            if( isInFreeList(memStart,currIndex)==-1)
-		    {
-		    	printf("Every flee block in free_list?\n");
-			    return -1;	
-		    }
+    while(bins && candidates < ALIGN_CANDIDATES)
+    {
+        int index = __builtin_ctzll(bins);
+
+        bins &= bins - 1;
+        for(bp = (void *)GET(arena->heapStart + index*WSIZE);
+            bp && candidates < ALIGN_CANDIDATES;
+            bp = (void *)GET(bp+WSIZE), candidates++)
+        {
+            if(alignedLead(bp, align) + asize <= GET_SIZE(HDRP(bp)))
+                return bp;
         }
-		memStart += GET_SIZE(HDRP(memStart));
-	}
+    }
 
-    return 0;
+    /* The smallest tree block may fit; one with a whole alignment
+     * to spare always does */
+    if((bp = treeBestFit(asize)) && alignedLead(bp, align) + asize <= GET_SIZE(HDRP(bp)))
+        return bp;
+    return treeBestFit(asize + align + MIN_BLOCK);
 }
-int isInFreeList(void* bp,int currIndex)
+
+/*
+ * allocAlignedBlock
+ * Allocate a block whose payload of exactly payload bytes starts
+ * on an align boundary. A free block that already has room at an
+ * aligned spot is used when there is one; otherwise a block big
+ * enough for any alignment is taken. The slack on either side
+ * goes back to the free lists.
+ */
+void *allocAlignedBlock(size_t align, size_t payload)
 {
-	
-	void* baseFromIndex = HeapStart + currIndex*WSIZE;
-	void* head = GET(baseFromIndex);
-		while(head)
-		{
-			if(bp==head)
-				return 1;
-			head = GET(head);
-		}	
-		
-	return -1;
+    size_t asize, total, lead;
+    void* bp;
+    void* aligned;
+
+    /* Neither the adjusted size nor the padded request may wrap */
+    if(payload > MAX_REQUEST)
+        return NULL;
+    asize = getAdjustedSize(payload);
+    if(asize > SIZE_MAX - MIN_BLOCK - align)
+        return NULL;
+
+    if((bp = alignedFit(align, asize)) != NULL)
+    {
+        removeFromFreeList(bp);
+        place(bp, GET_SIZE(HDRP(bp)));
+    }
+    else if((bp = mallocBlock(asize + align + MIN_BLOCK)) == NULL)
+    {
+        return NULL;
+    }
+
+    total = GET_SIZE(HDRP(bp));
+    lead = alignedLead(bp, align);
+    aligned = bp + lead;
+
+    if(lead)
+    {
+        PUT(HDRP(aligned), PACK(total - lead, ALLOC));
+        PUT(HDRP(bp), PACK(lead, GET_PREV_ALLOC(HDRP(bp))));
+        PUT(FTRP(bp), PACK(lead, 0));
+        addToFreeList(coalesce(bp));
+    }
+    trimBlock(aligned, asize);
+    return aligned;
+}
+
+int isSlabPointer(void *ptr)
+{
+    arena_t* a = arenaOf(ptr);
+    uintptr_t page;
+
+    if(a == NULL)
+        return 0;
+    page = ((uintptr_t)ptr >> RUN_SHIFT) - a->runBasePage;
+    if(page >= RUN_MAP_WORDS * 64)
+        return 0;
+    return (__atomic_load_n(&a->runMap[page / 64], __ATOMIC_RELAXED) >> (page % 64)) & 1;
+}
+
+/* runMap is read without the arena lock in mm_free, so update it atomically */
+void setRunMapped(slab_run_t* run, int mapped)
+{
+    uintptr_t page = ((uintptr_t)run >> RUN_SHIFT) - arena->runBasePage;
+
+    if(mapped)
+        __atomic_fetch_or(&arena->runMap[page / 64], (uint64_t)1 << (page % 64), __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_and(&arena->runMap[page / 64], ~((uint64_t)1 << (page % 64)), __ATOMIC_RELAXED);
+}
+
+void linkRun(slab_run_t* run)
+{
+    run->prev = NULL;
+    run->next = arena->slabPartial[run->cls];
+    if(run->next)
+        run->next->prev = run;
+    arena->slabPartial[run->cls] = run;
+}
+
+void unlinkRun(slab_run_t* run)
+{
+    if(run->prev)
+        run->prev->next = run->next;
+    else
+        arena->slabPartial[run->cls] = run->next;
+    if(run->next)
+        run->next->prev = run->prev;
+}
+
+/* Carve a fresh run for class cls, or NULL if the page map can't cover it */
+slab_run_t* newRun(int cls)
+{
+    slab_run_t* run;
+    uintptr_t page;
+    int i;
+
+    if((run = allocAlignedBlock(RUN_SIZE, RUN_SIZE)) == NULL)
+        return NULL;
+
+    page = ((uintptr_t)run >> RUN_SHIFT) - arena->runBasePage;
+    if(page >= RUN_MAP_WORDS * 64)
+    {
+        freeBlock(run);
+        return NULL;
+    }
+
+    run->cls = cls;
+    run->slotSize = (cls + 1) * DSIZE;
+    run->nslots = (RUN_SIZE - RUN_HEADER) / run->slotSize;
+    run->nfree = run->nslots;
+    for(i = 0; i < 4; i++)
+    {
+        int bits = run->nslots - 64*i;
+        run->freeMap[i] = bits >= 64 ? ~(uint64_t)0 : (bits > 0 ? ((uint64_t)1 << bits) - 1 : 0);
+    }
+    setRunMapped(run, 1);
+    linkRun(run);
+    return run;
+}
+
+void *slabAlloc(size_t size)
+{
+    int cls = SLAB_CLASS(size);
+    slab_run_t* run = arena->slabPartial[cls];
+    int i, slot;
+
+    if(run == NULL && (run = newRun(cls)) == NULL)
+        return NULL;
+
+    for(i = 0; run->freeMap[i] == 0; i++)
+        ;
+    slot = 64*i + __builtin_ctzll(run->freeMap[i]);
+    run->freeMap[i] &= run->freeMap[i] - 1;
+
+    if(--run->nfree == 0)
+        unlinkRun(run);
+    return (char *)run + RUN_HEADER + slot * run->slotSize;
+}
+
+void slabFree(void *ptr)
+{
+    slab_run_t* run = SLAB_RUN(ptr);
+    int slot = ((char *)ptr - (char *)run - RUN_HEADER) / run->slotSize;
+
+    run->freeMap[slot / 64] |= (uint64_t)1 << (slot % 64);
+    if(run->nfree++ == 0)
+        linkRun(run);
+
+    /* Hand an empty run back to the heap unless it is the class's last */
+    if(run->nfree == run->nslots && (run->prev || run->next))
+    {
+        unlinkRun(run);
+        setRunMapped(run, 0);
+        freeBlock(run);
+    }
+}
+
+/**********************************************************
+ * Huge blocks
+ * Requests of mmapThreshold bytes or more bypass mem_sbrk and
+ * get a page-granular mapping of their own. The header keeps
+ * the mapping length with MMAPPED set, so free() can unmap it
+ * without touching any arena. The word below the header holds
+ * the payload's offset into the mapping: DSIZE normally, more
+ * for blocks mapped with a larger alignment.
+ **********************************************************/
+
+#define HUGE_LEAD(bp)   GET((char *)(bp) - DSIZE)
+
+/* Huge mappings are the only blocks outside every arena */
+int isHugePointer(void *ptr)
+{
+    return arenaOf(ptr) == NULL;
+}
+
+/* Mapping length for a huge block with size payload bytes, or 0
+ * when that overflows */
+size_t hugeMapSize(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    if(size > SIZE_MAX - DSIZE - page)
+        return 0;
+    return (size + DSIZE + page - 1) & ~(page - 1);
+}
+
+void *hugeAlloc(size_t size)
+{
+    return hugeAlignedAlloc(DSIZE, size);
+}
+
+/* Map a huge block whose payload is a multiple of align, a power
+ * of two of at least DSIZE, by over-mapping and skipping a lead */
+void *hugeAlignedAlloc(size_t align, size_t size)
+{
+    size_t len;
+    void* map;
+    void* bp;
+
+    if(size > SIZE_MAX - align || (len = hugeMapSize(size + align - DSIZE)) == 0
+       || (map = mem_map(len)) == (void *)-1)
+        return NULL;
+
+    /* Keep the payload aligned behind a normal header */
+    bp = (void *)(((uintptr_t)map + DSIZE + align - 1) & ~(align - 1));
+    PUT((char *)bp - DSIZE, (char *)bp - (char *)map);
+    PUT(HDRP(bp), PACK(len, MMAPPED | ALLOC));
+    __atomic_fetch_add(&hugeBlocks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hugeBytes, len, __ATOMIC_RELAXED);
+    return bp;
+}
+
+void hugeFree(void *ptr)
+{
+    size_t len = GET_SIZE(HDRP(ptr));
+
+    __atomic_fetch_sub(&hugeBlocks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&hugeBytes, len, __ATOMIC_RELAXED);
+    mem_unmap(ptr - HUGE_LEAD(ptr), len);
+}
+
+/* Resize a huge block, remapping while it stays above the threshold */
+void *hugeRealloc(void *ptr, size_t size)
+{
+    size_t oldLen = GET_SIZE(HDRP(ptr));
+    size_t lead = HUGE_LEAD(ptr);
+    size_t len;
+    void* map;
+    void* newptr;
+
+    if(size >= mmapThreshold)
+    {
+        /* The lead moves with the mapping, which keeps alignments
+         * up to a page */
+        if(size > SIZE_MAX - lead || (len = hugeMapSize(size + lead - DSIZE)) == 0)
+            return NULL;
+        if(len == oldLen)
+            return ptr;
+        if((map = mem_remap(ptr - lead, oldLen, len)) == (void *)-1)
+            return NULL;
+        newptr = map + lead;
+        PUT(HDRP(newptr), PACK(len, MMAPPED | ALLOC));
+        __atomic_fetch_add(&hugeBytes, len - oldLen, __ATOMIC_RELAXED);
+        return newptr;
+    }
+
+    if((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, size);
+    hugeFree(ptr);
+    return newptr;
+}
+
+void mm_set_mmap_threshold(size_t threshold)
+{
+    mmapThreshold = threshold;
+}
+
+/**********************************************************
+ * Per-thread cache
+ * Each thread keeps a short LIFO of recently freed blocks for
+ * every exact-size bin. Cached blocks stay marked allocated so
+ * coalesce() treats them as in use, and the list is threaded
+ * through the first payload word. Only refills and flushes
+ * touch the thread's arena, TCACHE_BATCH blocks per lock. Only
+ * blocks of that arena are cached.
+ **********************************************************/
+
+/* Drop entries left over from a heap that mm_init has since reset */
+tcache_t* tcacheLocal(void)
+{
+    tcache_t* tc = &tcache;
+
+    if(tc->epoch != heapEpoch)
+    {
+        memset(tc->head, 0, sizeof(tc->head));
+        memset(tc->count, 0, sizeof(tc->count));
+        tc->home = NULL;
+        tc->epoch = heapEpoch;
+        if(!tc->registered)
+        {
+            pthread_once(&tcacheKeyOnce, tcacheMakeKey);
+            pthread_setspecific(tcacheKey, tc);
+            tc->registered = 1;
+        }
+    }
+    if(tc->home == NULL)
+        tc->home = arenaAssign();
+    return tc;
+}
+
+/* Pull up to TCACHE_BATCH same-size blocks off the shared bin,
+ * or slots off a partial run for slab classes */
+void tcacheRefill(tcache_t* tc, int index)
+{
+    void* baseOfIndex = arena->heapStart + index*WSIZE;
+    void* bp;
+    int moved = 0;
+
+    if(index >= NUM_SMALL_BINS)
+    {
+        int cls = index - NUM_SMALL_BINS;
+        while(moved < TCACHE_BATCH && tc->count[index] < TCACHE_MAX
+              && arena->slabPartial[cls] != NULL)
+        {
+            bp = slabAlloc((cls + 1) * DSIZE);
+            PUT(bp, (uintptr_t)tc->head[index]);
+            tc->head[index] = bp;
+            tc->count[index]++;
+            moved++;
+        }
+        return;
+    }
+
+    while(moved < TCACHE_BATCH && tc->count[index] < TCACHE_MAX)
+    {
+        if(arena->quick[index])
+        {
+            bp = quickPop(index);
+        }
+        else if((bp = (void *)GET(baseOfIndex)) != NULL)
+        {
+            removeFromFreeList(bp);
+            place(bp, GET_SIZE(HDRP(bp)));
+        }
+        else
+        {
+            break;
+        }
+        PUT(bp, (uintptr_t)tc->head[index]);
+        tc->head[index] = bp;
+        tc->count[index]++;
+        moved++;
+    }
+}
+
+/* Keep the hottest entries and return the rest to the shared heap */
+void tcacheFlush(tcache_t* tc, int index, int keep)
+{
+    void* bp = tc->head[index];
+    void* next;
+    int i;
+
+    if(keep == 0)
+    {
+        tc->head[index] = NULL;
+    }
+    else
+    {
+        for(i = 1; i < keep; i++)
+            bp = (void *)GET(bp);
+        next = (void *)GET(bp);
+        PUT(bp, 0);
+        bp = next;
+    }
+
+    arenaLock(tc->home);
+    while(bp)
+    {
+        next = (void *)GET(bp);
+        heapFree(bp);
+        bp = next;
+    }
+    arenaUnlock();
+    tc->count[index] = keep;
+}
+
+/* Cache ptr in bin index, flushing a batch if the bin is full */
+void tcachePush(tcache_t* tc, int index, void* ptr)
+{
+    if(tc->count[index] >= TCACHE_MAX)
+        tcacheFlush(tc, index, TCACHE_MAX - TCACHE_BATCH);
+    PUT(ptr, (uintptr_t)tc->head[index]);
+    tc->head[index] = ptr;
+    tc->count[index]++;
+}
+
+/* Thread-exit destructor: hand every cached block back */
+void tcacheRelease(void* arg)
+{
+    tcache_t* tc = arg;
+    int index;
+
+    if(tc->epoch != heapEpoch)
+        return;
+    for(index = 0; index < TCACHE_BINS; index++)
+    {
+        if(tc->count[index])
+            tcacheFlush(tc, index, 0);
+    }
+}
+
+void tcacheMakeKey(void)
+{
+    pthread_key_create(&tcacheKey, tcacheRelease);
+}
+
+/**********************************************************
+ * mm_malloc
+ * Allocate a block of size bytes.
+ * Small sizes are served from the per-thread cache when
+ * possible, then from slab runs; everything else goes to the
+ * thread's arena under its lock. Blocks other threads freed
+ * back to that arena are reclaimed first.
+ **********************************************************/
+void *mm_malloc(size_t size)
+{
+    size_t adjustedSize; /* adjusted block size */
+    tcache_t* tc;
+    void* bp;
+    int index;
+
+    CHECK_TICK();
+
+    /* Ignore spurious requests */
+    if (size == 0 || size > MAX_REQUEST)
+        return NULL;
+
+    if(size >= mmapThreshold)
+        return hugeAlloc(size);
+
+    tc = tcacheLocal();
+    if(__atomic_load_n(&tc->home->remoteFrees, __ATOMIC_RELAXED))
+    {
+        arenaLock(tc->home);
+        arenaDrain();
+        arenaUnlock();
+    }
+
+    if(size <= SLAB_MAX)
+    {
+        index = NUM_SMALL_BINS + SLAB_CLASS(size);
+    }
+    else
+    {
+        adjustedSize = getAdjustedSize(size);
+        if(adjustedSize > SMALL_BIN_MAX)
+        {
+            arenaLock(tc->home);
+            bp = mallocBlock(adjustedSize);
+            arenaUnlock();
+            return bp;
+        }
+        index = getIndex(adjustedSize);
+    }
+
+    if((bp = tc->head[index]) != NULL)
+    {
+        tc->head[index] = (void *)GET(bp);
+        tc->count[index]--;
+        return bp;
+    }
+
+    arenaLock(tc->home);
+    bp = heapAlloc(size);
+    if(bp)
+        tcacheRefill(tc, index);
+    arenaUnlock();
+    return bp;
+}
+
+/**********************************************************
+ * mm_free
+ * Small blocks go to the per-thread cache, which flushes a
+ * batch back to the arena once it is full. Blocks of another
+ * thread's arena are queued on it without locking, see
+ * remoteFree.
+ **********************************************************/
+void mm_free(void *ptr)
+{
+    tcache_t* tc;
+    arena_t* owner;
+    size_t size;
+    int index;
+
+    CHECK_TICK();
+
+    if(ptr == NULL)
+        return;
+
+    if((owner = arenaOf(ptr)) == NULL)
+    {
+        hugeFree(ptr);
+        return;
+    }
+
+    tc = tcacheLocal();
+    if(owner != tc->home)
+    {
+        remoteFree(owner, ptr);
+        return;
+    }
+
+    if(isSlabPointer(ptr))
+    {
+        index = NUM_SMALL_BINS + SLAB_RUN(ptr)->cls;
+    }
+    else
+    {
+        size = GET_SHARED(HDRP(ptr)) & ~(DSIZE - 1);
+        if(size > SMALL_BIN_MAX)
+        {
+            arenaLock(owner);
+            if(size <= QUICK_MAX)
+                quickPush(ptr);
+            else
+                freeBlock(ptr);
+            arenaUnlock();
+            return;
+        }
+        index = getIndex(size);
+    }
+
+    tcachePush(tc, index, ptr);
+}
+
+/**********************************************************
+ * zeroBlock
+ * Zero the first bytes of block bp. Memory at or above fresh,
+ * the arena's never-written space when bp was carved from the
+ * top chunk, is already zero. Large recycled spans have their
+ * whole pages discarded so the OS hands back zero pages.
+ **********************************************************/
+void zeroBlock(void* bp, size_t bytes, char* fresh)
+{
+    uintptr_t page = mem_pagesize();
+    char* start = bp;
+    char* end = start + bytes;
+    char* from;
+    char* to;
+
+    if(end > fresh)
+        end = MAX(start, fresh);
+
+    from = (char *)(((uintptr_t)start + page - 1) & ~(page - 1));
+    to = (char *)((uintptr_t)end & ~(page - 1));
+    if(end - start < CALLOC_DISCARD || to <= from)
+    {
+        memset(start, 0, end - start);
+        return;
+    }
+    memset(start, 0, from - start);
+    mem_purge(from, to - from);
+    memset(to, 0, end - to);
+}
+
+/**********************************************************
+ * mm_calloc
+ * Allocate nmemb zeroed elements of size bytes. Huge blocks
+ * are fresh mappings and need no zeroing; other large blocks
+ * are zeroed only where they were used before, see zeroBlock.
+ **********************************************************/
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    size_t bytes, asize;
+    tcache_t* tc;
+    char* fresh;
+    void* bp;
+
+    if(size != 0 && nmemb > SIZE_MAX / size)
+        return NULL;
+    bytes = nmemb * size;
+    if(bytes == 0 || bytes > MAX_REQUEST)
+        return NULL;
+    if(bytes >= mmapThreshold)
+        return hugeAlloc(bytes);
+
+    asize = getAdjustedSize(bytes);
+    if(bytes <= SLAB_MAX || asize <= SMALL_BIN_MAX)
+    {
+        if((bp = mm_malloc(bytes)) != NULL)
+            memset(bp, 0, bytes);
+        return bp;
+    }
+
+    tc = tcacheLocal();
+    arenaLock(tc->home);
+    arenaDrain();
+    fresh = arena->fresh;
+    bp = mallocBlock(asize);
+    arenaUnlock();
+    if(bp != NULL)
+        zeroBlock(bp, bytes, fresh);
+    return bp;
+}
+
+/**********************************************************
+ * mm_free_sized
+ * Free ptr, which the caller allocated with size bytes. A
+ * cacheable size skips the header read and the slab lookup;
+ * any other size takes the mm_free path.
+ **********************************************************/
+void mm_free_sized(void *ptr, size_t size)
+{
+    tcache_t* tc;
+    arena_t* owner;
+    size_t asize;
+
+    if(ptr == NULL)
+        return;
+
+    /* Small sizes may still be slab slots, and any size may be huge
+     * when the threshold was lowered */
+    asize = getAdjustedSize(size);
+    if(size <= SLAB_MAX || asize > SMALL_BIN_MAX || size >= mmapThreshold
+       || (owner = arenaOf(ptr)) == NULL)
+    {
+        mm_free(ptr);
+        return;
+    }
+
+    tc = tcacheLocal();
+    if(owner != tc->home)
+    {
+        remoteFree(owner, ptr);
+        return;
+    }
+    tcachePush(tc, getIndex(asize), ptr);
+}
+
+/**********************************************************
+ * mm_usable_size
+ * Bytes the caller may use at ptr, at least what it asked for
+ **********************************************************/
+size_t mm_usable_size(void *ptr)
+{
+    if(ptr == NULL)
+        return 0;
+    if(isHugePointer(ptr))
+        return GET_SIZE(HDRP(ptr)) - HUGE_LEAD(ptr);
+    if(isSlabPointer(ptr))
+        return SLAB_RUN(ptr)->slotSize;
+    return GET_SIZE(HDRP(ptr)) - OVERHEAD;
+}
+
+/**********************************************************
+ * mm_aligned_alloc
+ * Allocate size bytes at a multiple of align, a power of two.
+ * Returns NULL for any other align.
+ **********************************************************/
+void *mm_aligned_alloc(size_t align, size_t size)
+{
+    tcache_t* tc;
+    void* bp;
+
+    if(align == 0 || (align & (align - 1)))
+        return NULL;
+    if(align <= DSIZE)
+        return mm_malloc(size);
+    if(size == 0 || size > MAX_REQUEST)
+        return NULL;
+    if(size + align >= mmapThreshold)
+        return hugeAlignedAlloc(align, size);
+
+    tc = tcacheLocal();
+    arenaLock(tc->home);
+    bp = allocAlignedBlock(align, size);
+    arenaUnlock();
+    return bp;
+}
+
+/**********************************************************
+ * Batch allocation
+ * mm_malloc_batch carves all n blocks out of one span found
+ * or made by a single mallocBlock, and mm_free_batch sorts
+ * the pointers so each arena is locked once and back to back
+ * blocks are coalesced as one span.
+ **********************************************************/
+
+/* Split one mallocBlock span into n allocated blocks of asize
+ * bytes; the last one keeps any slack. arena->lock held */
+size_t carveBatch(size_t asize, size_t n, void** out)
+{
+    void* bp;
+    size_t left, i;
+
+    if(n > SIZE_MAX / asize || (bp = mallocBlock(asize * n)) == NULL)
+        return 0;
+
+    left = GET_SIZE(HDRP(bp));
+    for(i = 0; i < n - 1; i++)
+    {
+        out[i] = bp;
+        PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        left -= asize;
+        bp += asize;
+        PUT(HDRP(bp), PACK(left, PREV_ALLOC | ALLOC));
+    }
+    out[i] = bp;
+    return n;
+}
+
+/**********************************************************
+ * mm_malloc_batch
+ * Allocate n blocks of size bytes into out. Returns how many
+ * were allocated, which is less than n only when memory ran
+ * out.
+ **********************************************************/
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t done = 0;
+    tcache_t* tc;
+
+    if(size == 0 || size > MAX_REQUEST || n == 0)
+        return 0;
+
+    if(size >= mmapThreshold)
+    {
+        while(done < n && (out[done] = hugeAlloc(size)) != NULL)
+            done++;
+        return done;
+    }
+
+    tc = tcacheLocal();
+    arenaLock(tc->home);
+    arenaDrain();
+    if(size > SLAB_MAX)
+        done = carveBatch(getAdjustedSize(size), n, out);
+    while(done < n && (out[done] = heapAlloc(size)) != NULL)
+        done++;
+    arenaUnlock();
+    return done;
+}
+
+int comparePointers(const void* a, const void* b)
+{
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**********************************************************
+ * mm_free_batch
+ * Free the n pointers in ptrs, which is sorted in place.
+ * NULL entries are skipped.
+ **********************************************************/
+void mm_free_batch(void **ptrs, size_t n)
+{
+    arena_t* owner = NULL;
+    arena_t* a;
+    unsigned int blocks;
+    size_t i, size;
+    void* bp;
+
+    qsort(ptrs, n, sizeof(void *), comparePointers);
+    for(i = 0; i < n; i++)
+    {
+        if((bp = ptrs[i]) == NULL)
+            continue;
+        if((a = arenaOf(bp)) == NULL)
+        {
+            hugeFree(bp);
+            continue;
+        }
+        if(a != owner)
+        {
+            if(owner)
+                arenaUnlock();
+            arenaLock(a);
+            owner = a;
+        }
+        if(isSlabPointer(bp))
+        {
+            slabFree(bp);
+            continue;
+        }
+
+        /* Slots sit past their run's header, so a pointer at the
+         * next block's payload is always an ordinary block */
+        size = GET_SIZE(HDRP(bp));
+        for(blocks = 1; i + 1 < n && ptrs[i + 1] == bp + size; blocks++)
+            size += GET_SIZE(HDRP(ptrs[++i]));
+        freeSpan(bp, size, blocks);
+    }
+    if(owner)
+        arenaUnlock();
+}
+
+/**********************************************************
+ * mm_realloc
+ * Huge blocks are remapped without any lock; everything else
+ * resizes in its owning arena, see reallocBlock
+ **********************************************************/
+void *mm_realloc(void *ptr, size_t size)
+{
+    void* newptr;
+
+    CHECK_TICK();
+
+    if(ptr != NULL && isHugePointer(ptr))
+    {
+        if(size == 0)
+        {
+            hugeFree(ptr);
+            return NULL;
+        }
+        newptr = hugeRealloc(ptr, size);
+    }
+    else
+    {
+        arenaLock(ptr ? arenaOf(ptr) : tcacheLocal()->home);
+        newptr = reallocBlock(ptr, size);
+        arenaUnlock();
+    }
+    if(newptr == ptr && newptr != NULL)
+        __atomic_fetch_add(&reallocInPlace, 1, __ATOMIC_RELAXED);
+    else if(newptr != NULL && ptr != NULL)
+        __atomic_fetch_add(&reallocCopied, 1, __ATOMIC_RELAXED);
+    return newptr;
+}
+
+/**********************************************************
+ * mm_realloc_inplace
+ * Number of reallocs on sbrk heap blocks satisfied without
+ * copying the payload
+ **********************************************************/
+size_t mm_realloc_inplace(void)
+{
+    return __atomic_load_n(&reallocInPlace, __ATOMIC_RELAXED);
+}
+
+/**********************************************************
+ * Private heaps
+ * mm_heap_create reserves an arena that only the mm_heap_*
+ * calls allocate from. It is locked like any arena, so a heap
+ * may be shared between threads, and it never hands out huge
+ * mappings: every block lives in its ARENA_SIZE region, which
+ * mm_heap_destroy unmaps in one go without visiting the
+ * blocks. Its blocks may also go to mm_free, mm_realloc and
+ * mm_usable_size, which find the heap from the address. A NULL
+ * heap means the shared arenas behind mm_malloc.
+ * mm_stats, mm_check and mm_trim leave private heaps out.
+ **********************************************************/
+mm_heap_t *mm_heap_create(void)
+{
+    arena_t* h = arenaCreate();
+
+    if(h == NULL)
+        return NULL;
+    h->isHeap = 1;
+
+    pthread_mutex_lock(&arenasLock);
+    h->heapNext = heaps;
+    heaps = h;
+    pthread_mutex_unlock(&arenasLock);
+    return h;
+}
+
+void *mm_heap_malloc(mm_heap_t *heap, size_t size)
+{
+    void* bp;
+
+    if(heap == NULL)
+        return mm_malloc(size);
+    if(size == 0 || size > ARENA_SIZE)
+        return NULL;
+
+    arenaLock(heap);
+    if(heap->remoteFrees)
+        arenaDrain();
+    bp = heapAlloc(size);
+    arenaUnlock();
+    return bp;
+}
+
+void mm_heap_free(mm_heap_t *heap, void *ptr)
+{
+    if(heap == NULL)
+    {
+        mm_free(ptr);
+        return;
+    }
+    if(ptr == NULL)
+        return;
+
+    arenaLock(heap);
+    heapFree(ptr);
+    arenaUnlock();
+}
+
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size)
+{
+    void* newptr;
+
+    if(heap == NULL)
+        return mm_realloc(ptr, size);
+    if(size > ARENA_SIZE)
+        return NULL;
+
+    arenaLock(heap);
+    if(heap->remoteFrees)
+        arenaDrain();
+    newptr = reallocBlock(ptr, size);
+    arenaUnlock();
+    return newptr;
+}
+
+/* Release heap and every block still allocated from it */
+void mm_heap_destroy(mm_heap_t *heap)
+{
+    arena_t** link;
+
+    if(heap == NULL)
+        return;
+
+    pthread_mutex_lock(&arenasLock);
+    for(link = &heaps; *link != heap; link = &(*link)->heapNext)
+        ;
+    *link = heap->heapNext;
+    pthread_mutex_unlock(&arenasLock);
+
+    arenaMapSet(heap, 0);
+    mem_unmap(heap, ARENA_SIZE);
+}
+
+/**********************************************************
+ * Regions
+ * A region hands out memory by bumping a pointer through a
+ * lazily backed reservation: no headers, no footers, no frees.
+ * mm_region_reset takes it all back at once and
+ * mm_region_release unmaps it. Regions sit beside the heap
+ * and share nothing with it, so their pointers must never
+ * reach mm_free or mm_realloc. A region has no lock; use it
+ * from one thread at a time.
+ **********************************************************/
+mm_region_t *mm_region_create(void)
+{
+    region_t* r;
+
+    if((r = mem_reserve(REGION_SIZE)) == (void *)-1)
+        return NULL;
+    r->next = (char *)r + DSIZE * ((sizeof(region_t) + DSIZE - 1) / DSIZE);
+    r->end = (char *)r + REGION_SIZE;
+    r->touched = r->next;
+    return r;
+}
+
+/* size bytes aligned to DSIZE, or NULL once the region is full */
+void *mm_region_alloc(mm_region_t *region, size_t size)
+{
+    char* bp = region->next;
+
+    if(size == 0 || size > (size_t)(region->end - bp))
+        return NULL;
+    region->next = bp + ((size + DSIZE - 1) & ~(DSIZE - 1));
+    return bp;
+}
+
+/* Recycle everything allocated from region. Pages past
+ * REGION_KEEP go back to the OS, so one large request does not
+ * pin its memory for the life of the region. */
+void mm_region_reset(mm_region_t *region)
+{
+    uintptr_t page = mem_pagesize();
+    char* start = (char *)region + DSIZE * ((sizeof(region_t) + DSIZE - 1) / DSIZE);
+    char* keep = (char *)region + REGION_KEEP;
+
+    if(region->next > region->touched)
+        region->touched = region->next;
+    if(region->touched > keep)
+    {
+        mem_purge(keep, ((uintptr_t)region->touched - (uintptr_t)keep + page - 1) & ~(page - 1));
+        region->touched = keep;
+    }
+    region->next = start;
+}
+
+void mm_region_release(mm_region_t *region)
+{
+    if(region != NULL)
+        mem_unmap(region, REGION_SIZE);
+}
+
+/**********************************************************
+ * Statistics
+ * mm_stats adds up the arenas' event counters and walks their
+ * free lists and trees for the free space figures, taking one
+ * arena lock at a time. Arena counters start over with mm_init;
+ * the realloc and huge block counts run for the whole process.
+ **********************************************************/
+
+/* Count one fit search that looked at examined blocks; arena->lock held */
+void statsFit(size_t examined)
+{
+    arena->stats.fitCalls++;
+    arena->stats.fitExamined += examined;
+    arena->stats.fitMax = MAX(arena->stats.fitMax, examined);
+    arena->stats.fitHist[examined ? MIN(FLOOR_LOG2(examined) + 1, MM_STAT_FIT_HIST - 1) : 0]++;
+}
+
+/* Add the free blocks of the tree under node to st */
+void statsTree(void* node, mm_stats_t* st)
+{
+    size_t size;
+
+    if(node == NULL)
+        return;
+    size = GET_SIZE(HDRP(node));
+    st->tree_blocks++;
+    st->tree_bytes += size;
+    st->largest_free = MAX(st->largest_free, size);
+    statsTree(TREE_LEFT(node), st);
+    statsTree(TREE_RIGHT(node), st);
+}
+
+/* Add the current arena to st; arena->lock held */
+void statsArena(mm_stats_t* st)
+{
+    arena_stats_t* c = &arena->stats;
+    size_t free = 0, size;
+    void* bp;
+    int i;
+
+    for(i = 0; i < NUM_BINS; i++)
+    {
+        for(bp = (void *)GET(arena->heapStart + i*WSIZE); bp; bp = (void *)GET(bp + WSIZE))
+        {
+            size = GET_SIZE(HDRP(bp));
+            st->bin_blocks[i]++;
+            st->bin_bytes[i] += size;
+            st->largest_free = MAX(st->largest_free, size);
+            free += size;
+        }
+    }
+    size = st->tree_bytes;
+    statsTree(arena->treeRoot, st);
+    free += st->tree_bytes - size;
+    if(arena->top)
+    {
+        size = GET_SIZE(HDRP(arena->top));
+        st->top_bytes += size;
+        st->largest_free = MAX(st->largest_free, size);
+        free += size;
+    }
+
+    st->arenas++;
+    st->heap_bytes += arena->brk - arena->start;
+    st->free_bytes += free;
+    st->fit_calls += c->fitCalls;
+    st->fit_examined += c->fitExamined;
+    st->fit_max = MAX(st->fit_max, c->fitMax);
+    for(i = 0; i < MM_STAT_FIT_HIST; i++)
+        st->fit_hist[i] += c->fitHist[i];
+    st->splits += c->splits;
+    st->coalesces += c->coalesces;
+    st->sbrk_calls += c->sbrkCalls;
+}
+
+/**********************************************************
+ * mm_stats
+ * Fill st with a snapshot of the allocator's counters and
+ * free space. Each arena is consistent in itself; threads may
+ * run on in the others meanwhile.
+ **********************************************************/
+void mm_stats(mm_stats_t *st)
+{
+    arena_t* all[MAX_ARENAS];
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    pthread_mutex_lock(&arenasLock);
+    memcpy(all, arenas, sizeof(all));
+    pthread_mutex_unlock(&arenasLock);
+
+    for(i = 0; i < MAX_ARENAS; i++)
+    {
+        if(all[i] == NULL)
+            continue;
+        arenaLock(all[i]);
+        statsArena(st);
+        arenaUnlock();
+    }
+
+    st->live_bytes = st->heap_bytes - st->free_bytes;
+    st->fragmentation = st->free_bytes ? 1.0 - (double)st->largest_free / st->free_bytes : 0;
+    st->huge_blocks = __atomic_load_n(&hugeBlocks, __ATOMIC_RELAXED);
+    st->huge_bytes = __atomic_load_n(&hugeBytes, __ATOMIC_RELAXED);
+    st->realloc_inplace = __atomic_load_n(&reallocInPlace, __ATOMIC_RELAXED);
+    st->realloc_copied = __atomic_load_n(&reallocCopied, __ATOMIC_RELAXED);
+}
+
+/**********************************************************
+ * mm_stats_print
+ * Write st to out as text lines, or with json set as a single
+ * JSON object with no newline. Bins without free blocks are
+ * left out.
+ **********************************************************/
+void mm_stats_print(FILE *out, const mm_stats_t *st, int json)
+{
+    const char* sep = "";
+    int i;
+
+    if(json)
+    {
+        fprintf(out, "{\"arenas\": %zu, \"heap_bytes\": %zu, \"live_bytes\": %zu, "
+                "\"free_bytes\": %zu, \"top_bytes\": %zu, \"largest_free\": %zu, "
+                "\"fragmentation\": %.4f, \"huge_blocks\": %zu, \"huge_bytes\": %zu, "
+                "\"fit_calls\": %zu, \"fit_examined\": %zu, \"fit_max\": %zu, \"fit_hist\": [",
+                st->arenas, st->heap_bytes, st->live_bytes, st->free_bytes, st->top_bytes,
+                st->largest_free, st->fragmentation, st->huge_blocks, st->huge_bytes,
+                st->fit_calls, st->fit_examined, st->fit_max);
+        for(i = 0; i < MM_STAT_FIT_HIST; i++)
+            fprintf(out, "%s%zu", i ? ", " : "", st->fit_hist[i]);
+        fprintf(out, "], \"splits\": %zu, \"coalesces\": %zu, \"sbrk_calls\": %zu, "
+                "\"realloc_inplace\": %zu, \"realloc_copied\": %zu, "
+                "\"tree_blocks\": %zu, \"tree_bytes\": %zu, \"bins\": {",
+                st->splits, st->coalesces, st->sbrk_calls, st->realloc_inplace,
+                st->realloc_copied, st->tree_blocks, st->tree_bytes);
+        for(i = 0; i < MM_STAT_BINS; i++)
+        {
+            if(st->bin_blocks[i] == 0)
+                continue;
+            fprintf(out, "%s\"%d\": [%zu, %zu]", sep, i, st->bin_blocks[i], st->bin_bytes[i]);
+            sep = ", ";
+        }
+        fprintf(out, "}}");
+        return;
+    }
+
+    fprintf(out, "heap %zu bytes in %zu arenas: %zu live, %zu free (%zu top, largest %zu, fragmentation %.1f%%)\n",
+            st->heap_bytes, st->arenas, st->live_bytes, st->free_bytes, st->top_bytes,
+            st->largest_free, 100 * st->fragmentation);
+    fprintf(out, "huge %zu blocks, %zu bytes\n", st->huge_blocks, st->huge_bytes);
+    fprintf(out, "fits %zu, %.2f blocks examined each, at most %zu; by blocks examined:",
+            st->fit_calls, st->fit_calls ? (double)st->fit_examined / st->fit_calls : 0, st->fit_max);
+    for(i = 0; i < MM_STAT_FIT_HIST; i++)
+        fprintf(out, " %s%d:%zu", i == MM_STAT_FIT_HIST - 1 ? ">=" : "", i ? 1 << (i - 1) : 0, st->fit_hist[i]);
+    fprintf(out, "\nsplits %zu, coalesces %zu, sbrk calls %zu\n", st->splits, st->coalesces, st->sbrk_calls);
+    fprintf(out, "reallocs %zu in place, %zu copied\n", st->realloc_inplace, st->realloc_copied);
+    fprintf(out, "%6s %10s %12s\n", "bin", "blocks", "bytes");
+    for(i = 0; i < MM_STAT_BINS; i++)
+    {
+        if(st->bin_blocks[i])
+            fprintf(out, "%6d %10zu %12zu\n", i, st->bin_blocks[i], st->bin_bytes[i]);
+    }
+    fprintf(out, "%6s %10zu %12zu\n", "tree", st->tree_blocks, st->tree_bytes);
+}
+
+/**********************************************************
+ * mm_check
+ * Check the consistency of every arena in time linear in the
+ * heap size. One walk over the blocks checks headers, footers,
+ * PREV_ALLOC bits, coalescing and the top chunk, and sets a bit
+ * per free block in a side bitmap (one bit per DSIZE of heap).
+ * The bins and the tree are then walked against the bitmap,
+ * clearing each block's bit as it is reached, so an entry that
+ * is not a free block, a block listed twice and a free block on
+ * no list are all found without searching. Quick list entries
+ * must be allocated blocks of their list's size adding up to
+ * quickBytes. Thread caches and queued remote frees hold
+ * allocated blocks and are not looked at. The first problem
+ * found is printed to stderr.
+ * Returns 0 if the heap is consistent, -1 otherwise.
+ *********************************************************/
+int mm_check(void)
+{
+    arena_t* all[MAX_ARENAS];
+    int i, result;
+
+    pthread_mutex_lock(&arenasLock);
+    memcpy(all, arenas, sizeof(all));
+    pthread_mutex_unlock(&arenasLock);
+
+    for(i = 0; i < MAX_ARENAS; i++)
+    {
+        if(all[i] == NULL)
+            continue;
+        arenaLock(all[i]);
+        result = checkArena();
+        arenaUnlock();
+        if(result != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Report a problem with the current arena at bp; returns -1 */
+int checkFail(const char* what, void* bp)
+{
+    fprintf(stderr, "mm_check: arena %p: %s at %p\n", (void *)arena, what, bp);
+    return -1;
+}
+
+/* Bit of map standing for the block at bp */
+#define CHECK_BIT(bp)   ((size_t)((char *)(bp) - arena->start) / DSIZE)
+
+/* Clear the bit of bp if it marks a free block; 0 if it didn't,
+ * because bp is not a free block or was already reached */
+int checkClaim(uint64_t* map, void* bp)
+{
+    size_t bit;
+
+    if((char *)bp <= (char *)arena->heapStart || (char *)bp >= arena->brk
+       || ((uintptr_t)bp & (DSIZE - 1)))
+        return 0;
+    bit = CHECK_BIT(bp);
+    if(!((map[bit / 64] >> (bit % 64)) & 1))
+        return 0;
+    map[bit / 64] &= ~((uint64_t)1 << (bit % 64));
+    return 1;
+}
+
+/* Walk the current arena's blocks in address order, marking the free ones in map */
+int checkBlocks(uint64_t* map)
+{
+    void* bp = NEXT_BLKP(arena->heapStart);
+    int prevAlloc = 1;
+    int sawTop = (arena->top == NULL);
+    size_t runs = 0, mapped = 0;
+    size_t size, bit;
+    slab_run_t* run;
+    int i;
+
+    for(; (size = GET_SIZE(HDRP(bp))) != 0; bp = NEXT_BLKP(bp))
+    {
+        if(size < MIN_BLOCK || size > (size_t)(arena->brk - (char *)bp))
+            return checkFail("block size runs outside the heap", bp);
+        if((GET_PREV_ALLOC(HDRP(bp)) != 0) != prevAlloc)
+            return checkFail("PREV_ALLOC bit disagrees with the previous block", bp);
+        if(bp == arena->top)
+        {
+            sawTop = 1;
+            if(GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0)
+                return checkFail("top chunk is not the last block", bp);
+        }
+
+        if(!GET_ALLOC(HDRP(bp)))
+        {
+            if(!prevAlloc)
+                return checkFail("free block escaped coalescing", bp);
+            if(GET(FTRP(bp)) != PACK(size, 0))
+                return checkFail("footer does not match header", bp);
+            bit = CHECK_BIT(bp);
+            map[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+        else if(((uintptr_t)bp & (RUN_SIZE - 1)) == 0 && isSlabPointer(bp))
+        {
+            run = bp;
+            runs++;
+            if(run->cls >= SLAB_CLASSES || run->slotSize != (run->cls + 1) * DSIZE
+               || run->nfree > run->nslots
+               || (unsigned)(__builtin_popcountll(run->freeMap[0]) + __builtin_popcountll(run->freeMap[1])
+                             + __builtin_popcountll(run->freeMap[2]) + __builtin_popcountll(run->freeMap[3]))
+                  != run->nfree)
+                return checkFail("slab run counts disagree", bp);
+        }
+        prevAlloc = GET_ALLOC(HDRP(bp)) != 0;
+    }
+
+    if((char *)bp != arena->brk)
+        return checkFail("epilogue is not at the break", bp);
+    if(!sawTop)
+        return checkFail("top chunk is not in the heap", arena->top);
+    for(i = 0; i < RUN_MAP_WORDS; i++)
+        mapped += __builtin_popcountll(arena->runMap[i]);
+    if(mapped != runs)
+        return checkFail("slab page map does not match the runs", arena->start);
+    return 0;
+}
+
+/* Walk every bin of the current arena, claiming its blocks from map */
+int checkBins(uint64_t* map)
+{
+    void* bp;
+    void* prev;
+    int i;
+
+    for(i = 0; i < NUM_BINS; i++)
+    {
+        bp = (void *)GET(arena->heapStart + i*WSIZE);
+        if(((arena->binMap & BIN_BIT(i)) != 0) != (bp != NULL))
+            return checkFail("binMap disagrees with the bin", arena->heapStart + i*WSIZE);
+        if(bp != NULL && i >= TREE_BIN)
+            return checkFail("tree sized block on a list", bp);
+
+        for(prev = NULL; bp; prev = bp, bp = (void *)GET(bp + WSIZE))
+        {
+            if(!checkClaim(map, bp))
+                return checkFail("list entry is not a free block, or is listed twice", bp);
+            if((void *)GET(bp) != prev)
+                return checkFail("prev link does not match the list", bp);
+            if(getIndex(GET_SIZE(HDRP(bp))) != i)
+                return checkFail("block is in the wrong bin", bp);
+#if FIT_POLICY == FIT_BEST
+            if(prev && i >= NUM_SMALL_BINS && blockBefore(bp, prev))
+                return checkFail("range bin is out of order", bp);
+#endif
+        }
+    }
+    return 0;
+}
+
+/* Check the current arena's quick lists against quickBytes */
+int checkQuick(void)
+{
+    size_t bytes = 0;
+    void* bp;
+    int i;
+
+    for(i = 0; i < QUICK_LISTS; i++)
+    {
+        for(bp = arena->quick[i]; bp; bp = (void *)GET(bp))
+        {
+            if((char *)bp <= (char *)arena->heapStart || (char *)bp >= arena->brk
+               || ((uintptr_t)bp & (DSIZE - 1)) || !GET_ALLOC(HDRP(bp))
+               || GET_SIZE(HDRP(bp)) != (size_t)(i + 1) * DSIZE)
+                return checkFail("quick list entry is not an allocated block of its size", bp);
+            if((bytes += GET_SIZE(HDRP(bp))) > arena->quickBytes)
+                return checkFail("quick lists hold more than quickBytes", bp);
+        }
+    }
+    if(bytes != arena->quickBytes)
+        return checkFail("quick lists hold less than quickBytes", arena->heapStart);
+    return 0;
+}
+
+/* Check the subtree at node, whose blocks must sort after lo and
+ * before hi, claiming them from map. Returns its black height,
+ * or -1 after reporting a problem. */
+int checkTree(uint64_t* map, void* node, void* parent, void* lo, void* hi)
+{
+    int left, right;
+
+    if(node == NULL)
+        return 1;
+    if(!checkClaim(map, node))
+        return checkFail("tree node is not a free block, or is listed twice", node);
+    if(TREE_PARENT(node) != parent)
+        return checkFail("parent link does not match the tree", node);
+    if(getIndex(GET_SIZE(HDRP(node))) < TREE_BIN)
+        return checkFail("list sized block in the tree", node);
+    if((lo && !blockBefore(lo, node)) || (hi && !blockBefore(node, hi)))
+        return checkFail("tree is out of order", node);
+    if(IS_RED(node) && (parent == NULL || IS_RED(parent)))
+        return checkFail("red root or red node under a red parent", node);
+
+    if((left = checkTree(map, TREE_LEFT(node), node, lo, node)) < 0
+       || (right = checkTree(map, TREE_RIGHT(node), node, node, hi)) < 0)
+        return -1;
+    if(left != right)
+        return checkFail("black heights differ under node", node);
+    return left + !IS_RED(node);
+}
+
+/* Any bit still set in map is a free block no list or tree holds */
+int checkUnlisted(uint64_t* map, size_t words)
+{
+    size_t i;
+
+    for(i = 0; i < words; i++)
+    {
+        if(map[i])
+            return checkFail("free block is on no list",
+                             arena->start + (i * 64 + __builtin_ctzll(map[i])) * DSIZE);
+    }
+    return 0;
+}
+
+#ifdef MM_CHECK_INTERVAL
+/* Count a call in a check build and check the heap every MM_CHECK_INTERVAL */
+size_t checkCalls = 0;
+
+void checkTick(void)
+{
+    if(__atomic_add_fetch(&checkCalls, 1, __ATOMIC_RELAXED) % MM_CHECK_INTERVAL == 0
+       && mm_check() != 0)
+        abort();
+}
+#endif
+
+/* Check the current arena; arena->lock held */
+int checkArena(void)
+{
+    size_t words = ((arena->brk - arena->start) / DSIZE + 63) / 64;
+    size_t page = mem_pagesize();
+    size_t len = (words * sizeof(uint64_t) + page - 1) & ~(page - 1);
+    uint64_t* map;
+    int result;
+
+    if(len == 0)
+        len = page;
+    if((map = mem_map(len)) == (void *)-1)
+        return checkFail("no memory for the free block bitmap", arena->start);
+
+    result = checkBlocks(map);
+    if(result == 0)
+        result = checkBins(map);
+    if(result == 0)
+        result = checkQuick();
+    if(result == 0 && checkTree(map, arena->treeRoot, NULL, NULL, NULL) < 0)
+        result = -1;
+    if(result == 0)
+        result = checkUnlisted(map, words);
+
+    mem_unmap(map, len);
+    return result;
 }
@@ -2,11 +2,76 @@
  *
  * The public interface to the students' memory allocator.
  */
+#include <stdio.h>
+
+/* Free list bins and fit histogram buckets reported by mm_stats */
+#define MM_STAT_BINS 64
+#define MM_STAT_FIT_HIST 8
+
+/* Snapshot filled by mm_stats. Byte counts cover the sbrk heap
+ * and arenas unless they say huge; live_bytes includes headers,
+ * slab runs and blocks held in thread caches and quick lists. fit_hist[i] counts
+ * best-fit searches that examined [2^(i-1), 2^i) blocks, with
+ * bucket 0 for none and the last bucket open ended. */
+typedef struct {
+    size_t arenas;
+    size_t heap_bytes;
+    size_t live_bytes;
+    size_t free_bytes;         /* free lists, tree and top chunks */
+    size_t top_bytes;
+    size_t largest_free;
+    double fragmentation;      /* 1 - largest_free / free_bytes */
+    size_t huge_blocks;
+    size_t huge_bytes;
+    size_t bin_blocks[MM_STAT_BINS];
+    size_t bin_bytes[MM_STAT_BINS];
+    size_t tree_blocks;
+    size_t tree_bytes;
+    size_t fit_calls;
+    size_t fit_examined;
+    size_t fit_max;
+    size_t fit_hist[MM_STAT_FIT_HIST];
+    size_t splits;
+    size_t coalesces;
+    size_t sbrk_calls;
+    size_t realloc_inplace;
+    size_t realloc_copied;
+} mm_stats_t;
+
+/* A private heap from mm_heap_create; see mm.c */
+typedef struct arena mm_heap_t;
+
+/* A bump allocator from mm_region_create; see mm.c */
+typedef struct region mm_region_t;
 
 int mm_init(void);
 void *mm_malloc(size_t size);
 void mm_free(void *ptr);
 void *mm_realloc(void *ptr, size_t size);
+void *mm_calloc(size_t nmemb, size_t size);
+void mm_set_mmap_threshold(size_t threshold);
+size_t mm_trim(void);
+size_t mm_realloc_inplace(void);
+int mm_check(void);
+void mm_stats(mm_stats_t *st);
+void mm_stats_print(FILE *out, const mm_stats_t *st, int json);
+size_t mm_malloc_batch(size_t size, size_t n, void **out);
+void mm_free_batch(void **ptrs, size_t n);
+void mm_free_sized(void *ptr, size_t size);
+size_t mm_usable_size(void *ptr);
+void *mm_aligned_alloc(size_t align, size_t size);
+mm_heap_t *mm_heap_create(void);
+void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+void mm_heap_free(mm_heap_t *heap, void *ptr);
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+void mm_heap_destroy(mm_heap_t *heap);
+mm_region_t *mm_region_create(void);
+void *mm_region_alloc(mm_region_t *region, size_t size);
+void mm_region_reset(mm_region_t *region);
+void mm_region_release(mm_region_t *region);
+void mm_fork_prepare(void);
+void mm_fork_parent(void);
+void mm_fork_child(void);
 void* extend_heap(size_t size);
 /* 
  * Students work in teams of one or two.  Teams enter their team name, personal
@@ -0,0 +1,148 @@
+/*
+ * mm.hpp - Header-only C++17 adapters for the mm.c package, so
+ *     containers can be moved onto it one at a time:
+ *
+ *         mm::allocator<T>    stateless, for std::vector<T, mm::allocator<T>>
+ *         mm::resource        a std::pmr::memory_resource over the default
+ *                             heap or an mm_heap_create heap
+ *
+ *     Both allocate with mm_malloc and free with mm_free_sized, which
+ *     skips the header read for small blocks; over-aligned types go
+ *     through mm_aligned_alloc. Failure throws std::bad_alloc. As for
+ *     the C API, the heap must be set up (mem_init, mm_init) first.
+ */
+#ifndef MM_HPP
+#define MM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <memory_resource>
+
+extern "C" {
+#include "mm.h"
+}
+
+namespace mm {
+
+/* Alignment every mm_malloc block already has */
+constexpr std::size_t malloc_align = 2 * sizeof(void *);
+
+/*
+ * allocate_bytes, free_bytes - the paths both adapters share. A
+ *     zero byte request still gets a unique block.
+ */
+inline void *allocate_bytes(std::size_t bytes, std::size_t align)
+{
+    void *p;
+
+    if (bytes == 0)
+        bytes = 1;
+    if (align <= malloc_align)
+        p = mm_malloc(bytes);
+    else
+        p = mm_aligned_alloc(align, bytes);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+inline void free_bytes(void *p, std::size_t bytes, std::size_t align)
+{
+    if (align <= malloc_align)
+        mm_free_sized(p, bytes == 0 ? 1 : bytes);
+    else
+        mm_free(p);
+}
+
+template <class T>
+struct allocator {
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept
+    {
+        free_bytes(p, n * sizeof(T), alignof(T));
+    }
+};
+
+template <class T, class U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+template <class T, class U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+/*
+ * resource - memory_resource over heap, or over the default heap
+ *     when heap is null. Private heaps have no aligned entry point,
+ *     so over-aligned requests there are padded and keep the block
+ *     start in the word below the aligned pointer.
+ */
+class resource : public std::pmr::memory_resource {
+public:
+    explicit resource(mm_heap_t *heap = nullptr) noexcept : heap_(heap) {}
+
+    mm_heap_t *heap() const noexcept { return heap_; }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t align) override
+    {
+        void *p;
+        std::uintptr_t aligned;
+
+        if (heap_ == nullptr)
+            return allocate_bytes(bytes, align);
+        if (align <= malloc_align) {
+            p = mm_heap_malloc(heap_, bytes == 0 ? 1 : bytes);
+        } else if (bytes > std::numeric_limits<std::size_t>::max() - align) {
+            p = nullptr;
+        } else if ((p = mm_heap_malloc(heap_, bytes + align)) != nullptr) {
+            aligned = (reinterpret_cast<std::uintptr_t>(p) + align) & ~(align - 1);
+            reinterpret_cast<void **>(aligned)[-1] = p;
+            p = reinterpret_cast<void *>(aligned);
+        }
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return p;
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t align) override
+    {
+        if (heap_ == nullptr)
+            free_bytes(p, bytes, align);
+        else if (align <= malloc_align)
+            mm_heap_free(heap_, p);
+        else
+            mm_heap_free(heap_, static_cast<void **>(p)[-1]);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        const resource *r = dynamic_cast<const resource *>(&other);
+
+        return r != nullptr && r->heap_ == heap_;
+    }
+
+    mm_heap_t *heap_;
+};
+
+/* The resource for the default heap */
+inline resource *default_resource() noexcept
+{
+    static resource r;
+    return &r;
+}
+
+} // namespace mm
+
+#endif /* MM_HPP */
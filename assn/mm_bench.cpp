@@ -0,0 +1,199 @@
+/*
+ * mm_bench.cpp - Times container churn on std::allocator against the
+ *     mm.c package, through mm::allocator<T> and through a
+ *     std::pmr::polymorphic_allocator on mm::resource (see mm.hpp):
+ *
+ *         unix> make mm_bench
+ *         unix> mm_bench [-r <rounds>] [-n <elements>]
+ *
+ *     Each workload builds a container of up to n elements, erases
+ *     part of it, refills it and tears it down, r times over:
+ *         vector          push_back growth of vector<long>, plus a
+ *                         vector<vector<int>> of short rows
+ *         unordered_map   insert, erase every other key, reinsert
+ *         map             the same on a red-black tree
+ *     The best of a few runs is reported in ns per element operation.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+#include "mm.hpp"
+extern "C" {
+#include "memlib.h"
+}
+
+/* Timed runs per workload and allocator; the fastest counts */
+#define RUNS 5
+
+#define DEFAULT_ROUNDS   200
+#define DEFAULT_ELEMENTS 2000
+
+static int rounds = DEFAULT_ROUNDS;
+static int elements = DEFAULT_ELEMENTS;
+
+/* Folded into every result so the compiler keeps the work */
+static volatile std::uint64_t sink;
+
+/*
+ * Alloc<T> names the allocator under test: std::allocator, mm::allocator
+ * or std::pmr::polymorphic_allocator, whose default resource main sets
+ * to mm::default_resource()
+ */
+template <template <class> class Alloc>
+static std::uint64_t vector_churn()
+{
+    std::uint64_t sum = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        std::vector<long, Alloc<long>> v;
+        std::vector<std::vector<int, Alloc<int>>, Alloc<std::vector<int, Alloc<int>>>> rows;
+
+        for (int i = 0; i < elements; i++)
+            v.push_back(i);
+        for (int i = 0; i < elements / 8; i++)
+            rows.emplace_back(1 + (i + r) % 24, i);
+        v.resize(elements / 2);
+        v.shrink_to_fit();
+        sum += v.size() + rows.size() + rows.back().size();
+    }
+    return sum;
+}
+
+template <template <class> class Alloc>
+static std::uint64_t unordered_map_churn()
+{
+    using pair = std::pair<const int, long>;
+    std::uint64_t sum = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        std::unordered_map<int, long, std::hash<int>, std::equal_to<int>, Alloc<pair>> m;
+
+        for (int i = 0; i < elements; i++)
+            m.emplace(i * 7919, i);
+        for (int i = 0; i < elements; i += 2)
+            m.erase(i * 7919);
+        for (int i = 0; i < elements; i += 2)
+            m.emplace(i * 7919 + 1, i);
+        sum += m.size();
+    }
+    return sum;
+}
+
+template <template <class> class Alloc>
+static std::uint64_t map_churn()
+{
+    using pair = std::pair<const int, long>;
+    std::uint64_t sum = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        std::map<int, long, std::less<int>, Alloc<pair>> m;
+
+        for (int i = 0; i < elements; i++)
+            m.emplace((i * 7919) % 100003, i);
+        for (int i = 0; i < elements; i += 2)
+            m.erase((i * 7919) % 100003);
+        for (int i = 0; i < elements; i += 2)
+            m.emplace((i * 7919) % 100003 + 100003, i);
+        sum += m.size();
+    }
+    return sum;
+}
+
+/*
+ * best_ns - fastest of RUNS runs of work, in ns per element operation;
+ *     every workload does about 2 * elements operations a round
+ */
+static double best_ns(std::uint64_t (*work)())
+{
+    double best = 0;
+
+    for (int i = 0; i < RUNS; i++) {
+        auto start = std::chrono::steady_clock::now();
+        sink = sink + work();
+        std::chrono::duration<double, std::nano> ns = std::chrono::steady_clock::now() - start;
+        if (i == 0 || ns.count() < best)
+            best = ns.count();
+    }
+    return best / (2.0 * rounds * elements);
+}
+
+struct workload {
+    const char *name;
+    std::uint64_t (*with_std)();
+    std::uint64_t (*with_mm)();
+    std::uint64_t (*with_pmr)();
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-h] [-r <rounds>] [-n <elements>]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-n <n>     Elements per container (default %d).\n", DEFAULT_ELEMENTS);
+    fprintf(stderr, "\t-r <n>     Rounds per run (default %d).\n", DEFAULT_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    static const workload workloads[] = {
+        {"vector", vector_churn<std::allocator>, vector_churn<mm::allocator>,
+         vector_churn<std::pmr::polymorphic_allocator>},
+        {"unordered_map", unordered_map_churn<std::allocator>, unordered_map_churn<mm::allocator>,
+         unordered_map_churn<std::pmr::polymorphic_allocator>},
+        {"map", map_churn<std::allocator>, map_churn<mm::allocator>,
+         map_churn<std::pmr::polymorphic_allocator>},
+    };
+    double std_ns, mm_ns, pmr_ns;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:r:")) != EOF) {
+        switch (c) {
+        case 'n':
+            if ((elements = atoi(optarg)) < 2) {
+                fprintf(stderr, "-n needs at least 2 elements\n");
+                exit(1);
+            }
+            break;
+        case 'r':
+            if ((rounds = atoi(optarg)) < 1) {
+                fprintf(stderr, "-r needs a positive count\n");
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    mem_init();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    std::pmr::set_default_resource(mm::default_resource());
+
+    printf("%d rounds of %d elements, ns per element op (best of %d)\n", rounds, elements, RUNS);
+    printf("%-14s %10s %10s %10s %8s\n", "workload", "std", "mm", "mm pmr", "std/mm");
+    for (const workload &w : workloads) {
+        std_ns = best_ns(w.with_std);
+        mm_ns = best_ns(w.with_mm);
+        pmr_ns = best_ns(w.with_pmr);
+        printf("%-14s %10.1f %10.1f %10.1f %7.2fx\n", w.name, std_ns, mm_ns, pmr_ns, std_ns / mm_ns);
+    }
+
+    std::pmr::set_default_resource(nullptr);
+    mem_deinit();
+    return 0;
+}
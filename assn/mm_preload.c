@@ -0,0 +1,311 @@
+/*
+ * mm_preload.c - Exports the standard malloc family on top of the
+ *     mm.c package, so unmodified programs can run on it:
+ *
+ *         unix> make libmm.so
+ *         unix> LD_PRELOAD=./libmm.so some_program
+ *
+ *     The library is built with memlib reserving a large heap, so
+ *     mem_sbrk moves a break through real, lazily backed memory.
+ *
+ *     Setting MM_RECORD also writes every call to a trace file, see
+ *     mm_record.c. Setting MM_STATS to a number of seconds prints
+ *     mm_stats to stderr that often and once more at exit, as JSON
+ *     lines if MM_STATS_JSON is set too.
+ *
+ *     The heap is set up by the first allocation, which may come from
+ *     the dynamic loader before any constructor has run. Allocations
+ *     made while that setup is still in progress on the same thread
+ *     are served from a small static buffer and never freed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_record.h"
+
+#define EXPORT __attribute__((visibility("default")))
+
+/* Bytes available to allocations made during setup */
+#define BOOT_SIZE (64 * 1024)
+
+/* Every boot block starts with its size, padded to keep 16 byte alignment */
+#define BOOT_HEADER 16
+
+static int ready;                   /* heap is set up */
+static int starting;                /* some thread is setting it up */
+static __thread int settingUp;      /* this thread is setting it up */
+
+static char bootBuf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t bootUsed;
+
+static int statsPeriod;             /* seconds between MM_STATS dumps, 0 for none */
+static int statsJson;
+
+/*
+ * bootAlloc - carve size bytes from the boot buffer; the caller is
+ *     the thread running setup, so no lock is needed
+ */
+static void *bootAlloc(size_t size)
+{
+    size_t need = BOOT_HEADER + ((size + 15) & ~(size_t)15);
+    char *p;
+
+    /* size is checked first, as need wraps for sizes near SIZE_MAX */
+    if (size > BOOT_SIZE || need > BOOT_SIZE - bootUsed) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    p = bootBuf + bootUsed;
+    bootUsed += need;
+    *(size_t *)p = size;
+    return p + BOOT_HEADER;
+}
+
+static int isBoot(void *ptr)
+{
+    return (char *)ptr >= bootBuf && (char *)ptr < bootBuf + BOOT_SIZE;
+}
+
+static size_t bootSize(void *ptr)
+{
+    return *(size_t *)((char *)ptr - BOOT_HEADER);
+}
+
+/*
+ * heapReady - set the heap up on first use. Returns 0 only for a
+ *     call made from inside setup, which must use bootAlloc.
+ */
+static int heapReady(void)
+{
+    int expected = 0;
+
+    if (__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+        return 1;
+    if (settingUp)
+        return 0;
+
+    if (!__atomic_compare_exchange_n(&starting, &expected, 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE))
+            sched_yield();
+        return 1;
+    }
+
+    settingUp = 1;
+    mem_init();
+    if (mm_init() < 0)
+        abort();
+    pthread_atfork(mm_fork_prepare, mm_fork_parent, mm_fork_child);
+    settingUp = 0;
+    __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/*
+ * alignedAlloc - shared body of the aligned entry points, which all
+ *     promise a unique pointer for size 0
+ */
+static void *alignedAlloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (!heapReady()) {
+        if (align <= BOOT_HEADER)
+            return bootAlloc(size);
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (size == 0)
+        size = 1;
+    if ((p = mm_aligned_alloc(align, size)) == NULL)
+        errno = ENOMEM;
+    else if (mmRecording)
+        recordAlloc(p, size);
+    return p;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    void *p;
+
+    if (!heapReady())
+        return bootAlloc(size);
+    if (size == 0)
+        size = 1;
+    if ((p = mm_malloc(size)) == NULL)
+        errno = ENOMEM;
+    else if (mmRecording)
+        recordAlloc(p, size);
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr == NULL || isBoot(ptr))
+        return;
+    if (mmRecording)
+        recordFree(ptr);
+    mm_free(ptr);
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (!heapReady())
+        return bootAlloc(nmemb * size);     /* never used, so still zero */
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    if ((p = mm_calloc(nmemb, size)) == NULL)
+        errno = ENOMEM;
+    else if (mmRecording)
+        recordAlloc(p, nmemb * size);
+    return p;
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr != NULL && isBoot(ptr)) {
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, bootSize(ptr) < size ? bootSize(ptr) : size);
+        return p;
+    }
+    if (ptr == NULL)
+        return malloc(size);
+    if (mmRecording)
+        recordReallocBegin(ptr);
+    if ((p = mm_realloc(ptr, size)) == NULL && size != 0)
+        errno = ENOMEM;
+    if (mmRecording)
+        recordReallocEnd(ptr, p, size);
+    return p;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    void *p;
+
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0 || align == 0)
+        return EINVAL;
+    if ((p = alignedAlloc(align, size)) == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+    if (align == 0 || (align & (align - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alignedAlloc(align, size);
+}
+
+EXPORT void *memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return alignedAlloc(getpagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return alignedAlloc(page, (size + page - 1) & ~(page - 1));
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    if (ptr != NULL && isBoot(ptr))
+        return bootSize(ptr);
+    return mm_usable_size(ptr);
+}
+
+EXPORT int malloc_trim(size_t pad)
+{
+    (void)pad;
+    return heapReady() && mm_trim() > 0;
+}
+
+/*
+ * statsDump - print mm_stats to stderr, with the pid to tell
+ *     processes sharing the terminal apart
+ */
+static void statsDump(void)
+{
+    mm_stats_t st;
+
+    mm_stats(&st);
+    if (statsJson) {
+        fprintf(stderr, "{\"pid\": %d, \"stats\": ", (int)getpid());
+        mm_stats_print(stderr, &st, 1);
+        fprintf(stderr, "}\n");
+    } else {
+        fprintf(stderr, "mm_stats pid %d\n", (int)getpid());
+        mm_stats_print(stderr, &st, 0);
+    }
+}
+
+static void *statsMain(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        sleep(statsPeriod);
+        statsDump();
+    }
+    return NULL;
+}
+
+__attribute__((constructor))
+static void statsStart(void)
+{
+    const char *env = getenv("MM_STATS");
+    pthread_t tid;
+
+    if (env == NULL || (statsPeriod = atoi(env)) <= 0) {
+        statsPeriod = 0;
+        return;
+    }
+    statsJson = getenv("MM_STATS_JSON") != NULL;
+    if (heapReady() && pthread_create(&tid, NULL, statsMain, NULL) == 0)
+        pthread_detach(tid);
+}
+
+__attribute__((destructor))
+static void statsStop(void)
+{
+    if (statsPeriod)
+        statsDump();
+}
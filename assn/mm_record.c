@@ -0,0 +1,515 @@
+/*
+ * mm_record.c - Writes the allocation calls a program makes through
+ *     libmm.so to a trace file that mdriver and test_driver replay:
+ *
+ *         unix> MM_RECORD=app.rep LD_PRELOAD=./libmm.so app
+ *
+ *     A %p in the file name becomes the process id, so programs that
+ *     exec others under the same environment get a trace each. Forked
+ *     children that don't exec are not recorded.
+ *
+ *     With MM_RECORD_THREADS=1 as well, every request line ends with
+ *     the number of the thread that made it. test_driver skips that
+ *     column; mdriver does not accept it.
+ *
+ *     Each thread appends events to a ring of its own that only a
+ *     background writer thread drains, so recording takes no lock. A
+ *     global sequence number orders the events of all threads. The
+ *     writer turns block addresses into trace ids, and when the program
+ *     exits it fills in the header: the peak payload as the heap size
+ *     hint, then the id and op counts.
+ *
+ *     A realloc logs two events, one before the call, since from then
+ *     on another thread may get the old address back, and one with its
+ *     result. Blocks allocated before recording started are unknown to
+ *     the writer: frees of them are dropped and reallocs of them become
+ *     allocations.
+ *
+ *     mdriver's realloc check compares a signed char with the low byte
+ *     of the block id, so it wrongly rejects the realloc of any block
+ *     whose id has a low byte of 128 or more; recorded traces hit that
+ *     quickly. test_driver has no such check.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "memlib.h"
+#include "mm_record.h"
+
+#define RING_EVENTS  (1 << 16)      /* events buffered per thread */
+#define WRITER_NAP   1000000        /* ns the writer sleeps between drains */
+#define OUT_SIZE     (1 << 16)      /* trace bytes buffered before a write */
+#define MIN_SLOTS    (1 << 16)      /* initial address table size */
+#define MIN_PENDING  (1 << 16)      /* extra events room when pending grows */
+
+/* Fixed width, so the final counts can overwrite the placeholder */
+#define HEADER_FMT   "%20lu %20lu %20lu 1\n"
+
+/* Event types; EV_DETACH is a realloc about to release its block */
+#define EV_ALLOC    'a'
+#define EV_FREE     'f'
+#define EV_DETACH   'd'
+#define EV_REALLOC  'r'
+
+typedef struct {
+    unsigned long seq;
+    void *ptr;          /* block allocated or freed, or realloc's result */
+    void *old;          /* realloc's argument */
+    size_t size;
+    unsigned int tid;
+    char type;
+} event_t;
+
+/* Single producer, single consumer: the owner moves head, the writer tail */
+typedef struct ring {
+    struct ring *next;  /* every ring ever made, newest first */
+    int inUse;          /* owned by a live thread */
+    unsigned long head;
+    unsigned long tail;
+    event_t ev[RING_EVENTS];
+} ring_t;
+
+/* A live block in the writer's address table, keyed by address. While
+ * a realloc is under way its block is keyed by the address | 1. */
+typedef struct {
+    uintptr_t addr;     /* 0 for an empty slot */
+    unsigned long id;
+    size_t size;
+} block_t;
+
+int mmRecording;
+
+/* Producer side */
+static unsigned long nextSeq;
+static unsigned int nextTid;
+static ring_t *rings;
+static pthread_key_t ringKey;
+static __thread ring_t *myRing;
+static __thread unsigned int myTid;
+static __thread int quiet;          /* don't record this thread's calls */
+
+/* Writer side */
+static pthread_t writer;
+static int stopping;
+static int withThreads;
+static int fd;
+static event_t *pending;            /* drained but not yet written, by seq */
+static size_t numPending, maxPending;
+static unsigned long writeSeq;      /* seq of the next event to write */
+static block_t *table;
+static size_t numSlots, numLive;
+static unsigned long numIds, numOps;
+static size_t payload, peakPayload;
+static char out[OUT_SIZE];
+static size_t outLen;
+
+static size_t mapLen(size_t count, size_t elemSize)
+{
+    size_t page = mem_pagesize();
+
+    return (count * elemSize + page - 1) & ~(page - 1);
+}
+
+/* Zeroed array of count elements straight from the OS, since malloc
+ * would record the writer's own allocations */
+static void *mapArray(size_t count, size_t elemSize)
+{
+    void *p;
+
+    if ((p = mem_map(mapLen(count, elemSize))) == (void *)-1) {
+        fprintf(stderr, "mm_record: out of memory\n");
+        abort();
+    }
+    return p;
+}
+
+/*****************************************************************
+ * Producers
+ ****************************************************************/
+
+/* Hand the calling thread a ring, reusing one whose thread exited */
+static ring_t *ringClaim(void)
+{
+    ring_t *r;
+    int idle;
+
+    quiet = 1;      /* pthread_setspecific may allocate */
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        idle = 0;
+        if (__atomic_compare_exchange_n(&r->inUse, &idle, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (r == NULL) {
+        if ((r = mem_map(mapLen(1, sizeof(ring_t)))) == (void *)-1) {
+            quiet = 0;
+            return NULL;
+        }
+        r->inUse = 1;
+        r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    myTid = __atomic_fetch_add(&nextTid, 1, __ATOMIC_RELAXED);
+    pthread_setspecific(ringKey, r);
+    myRing = r;
+    quiet = 0;
+    return r;
+}
+
+/* Thread-exit destructor: let another thread have the ring */
+static void ringRelease(void *arg)
+{
+    ring_t *r = arg;
+
+    myRing = NULL;
+    __atomic_store_n(&r->inUse, 0, __ATOMIC_RELEASE);
+}
+
+static void recordEvent(char type, void *ptr, void *old, size_t size)
+{
+    ring_t *r = myRing;
+    unsigned long head;
+    event_t *e;
+
+    if (quiet || (r == NULL && (r = ringClaim()) == NULL))
+        return;
+
+    head = r->head;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= RING_EVENTS)
+        sched_yield();
+    e = &r->ev[head % RING_EVENTS];
+    e->seq = __atomic_fetch_add(&nextSeq, 1, __ATOMIC_RELAXED);
+    e->type = type;
+    e->ptr = ptr;
+    e->old = old;
+    e->size = size;
+    e->tid = myTid;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Call after the block is allocated */
+void recordAlloc(void *ptr, size_t size)
+{
+    recordEvent(EV_ALLOC, ptr, NULL, size);
+}
+
+/* Call before the block is freed */
+void recordFree(void *ptr)
+{
+    recordEvent(EV_FREE, ptr, NULL, 0);
+}
+
+/* Call before and after the realloc of old */
+void recordReallocBegin(void *old)
+{
+    recordEvent(EV_DETACH, NULL, old, 0);
+}
+
+void recordReallocEnd(void *old, void *ptr, size_t size)
+{
+    recordEvent(EV_REALLOC, ptr, old, size);
+}
+
+/*****************************************************************
+ * Writer
+ ****************************************************************/
+
+static void flushOut(void)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < outLen && (n = write(fd, out + done, outLen - done)) > 0)
+        done += n;
+    outLen = 0;
+}
+
+/* Write one request line; size is only written for 'a' and 'r' */
+static void writeOp(char type, unsigned long id, size_t size, unsigned int tid)
+{
+    if (outLen > OUT_SIZE - 128)
+        flushOut();
+    outLen += sprintf(out + outLen, type == EV_FREE ? "%c %lu" : "%c %lu %zu",
+                      type, id, size);
+    if (withThreads)
+        outLen += sprintf(out + outLen, " %u", tid);
+    out[outLen++] = '\n';
+    numOps++;
+}
+
+static size_t slotOf(uintptr_t addr)
+{
+    return ((addr >> 4) * 0x9E3779B97F4A7C15UL) & (numSlots - 1);
+}
+
+/* Live block at addr, or NULL */
+static block_t *blockFind(uintptr_t addr)
+{
+    size_t i;
+
+    for (i = slotOf(addr); table[i].addr; i = (i + 1) & (numSlots - 1))
+        if (table[i].addr == addr)
+            return &table[i];
+    return NULL;
+}
+
+static void blockInsert(uintptr_t addr, unsigned long id, size_t size)
+{
+    block_t *old = table;
+    size_t oldSlots = numSlots;
+    size_t i;
+
+    if (2 * (numLive + 1) > numSlots) {
+        numSlots = 2 * oldSlots;
+        table = mapArray(numSlots, sizeof(block_t));
+        numLive = 0;
+        for (i = 0; i < oldSlots; i++)
+            if (old[i].addr)
+                blockInsert(old[i].addr, old[i].id, old[i].size);
+        mem_unmap(old, mapLen(oldSlots, sizeof(block_t)));
+    }
+    for (i = slotOf(addr); table[i].addr; i = (i + 1) & (numSlots - 1))
+        ;
+    table[i].addr = addr;
+    table[i].id = id;
+    table[i].size = size;
+    numLive++;
+}
+
+/* Remove b, shifting later entries of its probe run back */
+static void blockRemove(block_t *b)
+{
+    size_t hole = b - table;
+    size_t i = hole, home;
+
+    table[hole].addr = 0;
+    for (i = (i + 1) & (numSlots - 1); table[i].addr; i = (i + 1) & (numSlots - 1)) {
+        home = slotOf(table[i].addr);
+        if (((i - home) & (numSlots - 1)) >= ((i - hole) & (numSlots - 1))) {
+            table[hole] = table[i];
+            table[i].addr = 0;
+            hole = i;
+        }
+    }
+    numLive--;
+}
+
+/* Move b to key addr, which must be free */
+static void blockRekey(block_t *b, uintptr_t addr)
+{
+    unsigned long id = b->id;
+    size_t size = b->size;
+
+    blockRemove(b);
+    blockInsert(addr, id, size);
+}
+
+static void writeFree(block_t *b, unsigned int tid)
+{
+    writeOp(EV_FREE, b->id, 0, tid);
+    payload -= b->size;
+    blockRemove(b);
+}
+
+/* Start tracking a new block at ptr. A block already there was freed
+ * by a call we never saw, so it is freed first. */
+static void writeAlloc(void *ptr, size_t size, unsigned int tid)
+{
+    block_t *b;
+
+    if ((b = blockFind((uintptr_t)ptr)) != NULL)
+        writeFree(b, tid);
+    writeOp(EV_ALLOC, numIds, size, tid);
+    blockInsert((uintptr_t)ptr, numIds++, size);
+    payload += size;
+    if (payload > peakPayload)
+        peakPayload = payload;
+}
+
+static void writeEvent(event_t *e)
+{
+    unsigned long id;
+    size_t size;
+    block_t *b;
+
+    switch (e->type) {
+    case EV_ALLOC:
+        writeAlloc(e->ptr, e->size, e->tid);
+        break;
+    case EV_FREE:
+        if ((b = blockFind((uintptr_t)e->ptr)) != NULL)
+            writeFree(b, e->tid);
+        break;
+    case EV_DETACH:
+        if ((b = blockFind((uintptr_t)e->old)) != NULL)
+            blockRekey(b, (uintptr_t)e->old | 1);
+        break;
+    default:
+        if ((b = blockFind((uintptr_t)e->old | 1)) == NULL)
+            b = blockFind((uintptr_t)e->old);
+        if (b == NULL) {
+            if (e->ptr)
+                writeAlloc(e->ptr, e->size, e->tid);
+        } else if (e->ptr == NULL && e->size == 0) {
+            writeFree(b, e->tid);
+        } else if (e->ptr == NULL) {
+            blockRekey(b, (uintptr_t)e->old);       /* failed, old is intact */
+        } else {
+            id = b->id;
+            size = b->size;
+            blockRemove(b);
+            if ((b = blockFind((uintptr_t)e->ptr)) != NULL)
+                writeFree(b, e->tid);
+            writeOp(EV_REALLOC, id, e->size, e->tid);
+            blockInsert((uintptr_t)e->ptr, id, e->size);
+            payload += e->size - size;
+            if (payload > peakPayload)
+                peakPayload = payload;
+        }
+        break;
+    }
+}
+
+static int compareSeq(const void *a, const void *b)
+{
+    unsigned long x = ((const event_t *)a)->seq;
+    unsigned long y = ((const event_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * drain - move every ring's events to pending and write out the run of
+ *     consecutive seqs from writeSeq. A missing seq belongs to an event
+ *     some thread is still publishing; final writes past such gaps.
+ */
+static void drain(int final)
+{
+    unsigned long tail, head;
+    size_t i;
+    ring_t *r;
+
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        tail = r->tail;
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (numPending + (head - tail) > maxPending) {
+            event_t *old = pending;
+            size_t want = 2 * maxPending;
+
+            if (want < numPending + (head - tail))
+                want = numPending + (head - tail) + MIN_PENDING;
+            pending = mapArray(want, sizeof(event_t));
+            if (old) {
+                memcpy(pending, old, numPending * sizeof(event_t));
+                mem_unmap(old, mapLen(maxPending, sizeof(event_t)));
+            }
+            maxPending = want;
+        }
+        for (; tail != head; tail++)
+            pending[numPending++] = r->ev[tail % RING_EVENTS];
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    qsort(pending, numPending, sizeof(event_t), compareSeq);
+    for (i = 0; i < numPending && (final || pending[i].seq == writeSeq); i++) {
+        writeEvent(&pending[i]);
+        writeSeq = pending[i].seq + 1;
+    }
+    memmove(pending, pending + i, (numPending - i) * sizeof(event_t));
+    numPending -= i;
+}
+
+static void *writerMain(void *arg)
+{
+    struct timespec nap = {0, WRITER_NAP};
+
+    quiet = 1;
+    numSlots = MIN_SLOTS;
+    table = mapArray(numSlots, sizeof(block_t));
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        drain(0);
+        nanosleep(&nap, NULL);
+    }
+    drain(1);
+    flushOut();
+    return arg;
+}
+
+/* Copy path to buf, replacing every %p with the process id */
+static void expandPath(char *buf, size_t len, const char *path)
+{
+    size_t n = 0;
+
+    for (; *path && n < len - 1; path++) {
+        if (path[0] == '%' && path[1] == 'p') {
+            n += snprintf(buf + n, len - n, "%d", (int)getpid());
+            path++;
+        } else {
+            buf[n++] = *path;
+        }
+    }
+    buf[n < len ? n : len - 1] = '\0';
+}
+
+/* The trace file belongs to the parent */
+static void recordForkChild(void)
+{
+    mmRecording = 0;
+}
+
+__attribute__((constructor))
+static void recordStart(void)
+{
+    const char *env = getenv("MM_RECORD");
+    const char *threads = getenv("MM_RECORD_THREADS");
+    char path[PATH_MAX];
+
+    if (env == NULL || *env == '\0')
+        return;
+    expandPath(path, sizeof(path), env);
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "mm_record: could not open %s\n", path);
+        return;
+    }
+    withThreads = threads != NULL && strcmp(threads, "0") != 0;
+    outLen = sprintf(out, HEADER_FMT, 0UL, 0UL, 0UL);
+
+    pthread_key_create(&ringKey, ringRelease);
+    pthread_atfork(NULL, NULL, recordForkChild);
+    if (pthread_create(&writer, NULL, writerMain, NULL) != 0) {
+        fprintf(stderr, "mm_record: could not start the writer\n");
+        close(fd);
+        return;
+    }
+    mmRecording = 1;
+}
+
+/* Runs at exit: write what is left and fill in the header */
+__attribute__((destructor))
+static void recordStop(void)
+{
+    char header[80];
+    int len;
+
+    if (!mmRecording)
+        return;
+    mmRecording = 0;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+
+    len = sprintf(header, HEADER_FMT, (unsigned long)(peakPayload < INT_MAX ? peakPayload : INT_MAX), numIds, numOps);
+    if (pwrite(fd, header, len, 0) != len)
+        fprintf(stderr, "mm_record: could not write the trace header\n");
+    close(fd);
+}
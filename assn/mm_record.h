@@ -0,0 +1,12 @@
+/*
+ * mm_record.h - Records the allocation calls made through libmm.so
+ *     as a .rep trace, see mm_record.c
+ */
+
+/* Nonzero while a trace is being written */
+extern int mmRecording;
+
+void recordAlloc(void *ptr, size_t size);
+void recordFree(void *ptr);
+void recordReallocBegin(void *old);
+void recordReallocEnd(void *old, void *ptr, size_t size);
@@ -0,0 +1,580 @@
+/*
+ * test_driver.c - Replays mdriver trace files against the mm.c
+ *     package and reports the latency distribution of every kind of
+ *     operation instead of an average throughput.
+ *
+ *     Each malloc, free and realloc is timed on its own with the
+ *     cycle counter (rdtsc; the clock.o shipped with the lab is a
+ *     stub on x86-64, so it is not used here). For every trace the
+ *     driver prints the p50, p99, p99.9 and max latency per operation
+ *     type, plus how memory utilization developed over the run. With
+ *     -j the same report is written as JSON. -S adds mm_stats
+ *     snapshots and -c runs mm_check, both between timed operations;
+ *     -c first checks that mm_calloc zeroes memory after mm_trim.
+ *
+ *     The trace format is the one mdriver reads:
+ *         <suggested heap size> <num ids> <num ops> <weight>
+ *         a <id> <bytes>    malloc
+ *         r <id> <bytes>    realloc
+ *         f <id>            free
+ *     Anything after those fields on a request line, such as the
+ *     thread number mm_record.c can add, is ignored.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/*
+ * read_cycles - current value of the cycle counter. Platforms without
+ *     rdtsc count nanoseconds instead.
+ */
+static inline uint64_t read_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Utilization samples taken per trace unless -s says otherwise */
+#define DEFAULT_SAMPLES 20
+
+/* Empty start/stop pairs timed to estimate the counter overhead */
+#define OVERHEAD_RUNS 1000
+
+#define MAXLINE 1024
+
+/* Operation types, indexing the latency tables */
+#define OP_ALLOC   0
+#define OP_FREE    1
+#define OP_REALLOC 2
+#define NUM_OPS    3
+
+static const char *op_names[NUM_OPS] = {"malloc", "free", "realloc"};
+
+/* One request from a trace file */
+typedef struct {
+    int type;       /* OP_ALLOC, OP_FREE or OP_REALLOC */
+    int index;      /* id of the block it works on */
+    size_t size;    /* requested bytes, unused for free */
+} traceop_t;
+
+/* A whole trace plus the live state of its blocks during replay */
+typedef struct {
+    char *filename;
+    int num_ids;
+    int num_ops;
+    traceop_t *ops;
+    char **blocks;      /* current pointer for each id */
+    size_t *sizes;      /* current payload bytes for each id */
+} trace_t;
+
+/* Latency summary for one operation type, in cycles */
+typedef struct {
+    int count;
+    double p50, p99, p999, max;
+} latency_t;
+
+/* Payload and heap size after an operation */
+typedef struct {
+    int op;
+    size_t payload;
+    size_t heap;
+} sample_t;
+
+/* Allocator statistics after an operation */
+typedef struct {
+    int op;
+    mm_stats_t stats;
+} snapshot_t;
+
+/* Everything reported for one trace */
+typedef struct {
+    latency_t latency[NUM_OPS];
+    sample_t *samples;
+    int num_samples;
+    snapshot_t *snapshots;
+    int num_snapshots;
+    size_t peak_payload;
+    size_t final_heap;
+    double peak_util;   /* best payload/heap ratio seen during the run */
+    double util;        /* peak payload over final heap, as mdriver scores it */
+} result_t;
+
+static void app_error(const char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-hj] [-o <file>] [-c <n>] [-s <n>] [-S <n>] [-t <dir>] [tracefile...]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-c <n>     Check heap consistency every <n> ops.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j         Report in JSON.\n");
+    fprintf(stderr, "\t-o <file>  Write the report to <file>.\n");
+    fprintf(stderr, "\t-s <n>     Take <n> utilization samples per trace.\n");
+    fprintf(stderr, "\t-S <n>     Report allocator stats every <n> ops and at the end.\n");
+    fprintf(stderr, "\t-t <dir>   Replay every .rep file in <dir>.\n");
+}
+
+/*
+ * read_trace - read a trace file into a trace_t
+ */
+static trace_t *read_trace(const char *filename)
+{
+    FILE *fp;
+    trace_t *trace;
+    char line[MAXLINE];
+    char type;
+    int weight, op, index;
+    unsigned long size;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        exit(1);
+    }
+
+    if ((trace = calloc(1, sizeof(trace_t))) == NULL)
+        app_error("calloc failed in read_trace");
+    trace->filename = strdup(filename);
+
+    if (fscanf(fp, "%*d %d %d %d", &trace->num_ids, &trace->num_ops, &weight) != 3) {
+        fprintf(stderr, "Bad trace header in %s\n", filename);
+        exit(1);
+    }
+    trace->ops = calloc(trace->num_ops, sizeof(traceop_t));
+    trace->blocks = calloc(trace->num_ids, sizeof(char *));
+    trace->sizes = calloc(trace->num_ids, sizeof(size_t));
+    if (!trace->ops || !trace->blocks || !trace->sizes)
+        app_error("calloc failed in read_trace");
+
+    op = 0;
+    while (op < trace->num_ops && fgets(line, MAXLINE, fp) != NULL) {
+        if (sscanf(line, " %c", &type) != 1)
+            continue;       /* blank, or the rest of the header line */
+        switch (type) {
+        case 'a':
+        case 'r':
+            if (sscanf(line, " %*c %d %lu", &index, &size) != 2)
+                app_error("Bad alloc or realloc request");
+            trace->ops[op].type = (type == 'a') ? OP_ALLOC : OP_REALLOC;
+            trace->ops[op].size = size;
+            break;
+        case 'f':
+            if (sscanf(line, " %*c %d", &index) != 1)
+                app_error("Bad free request");
+            trace->ops[op].type = OP_FREE;
+            break;
+        default:
+            fprintf(stderr, "Bogus type character (%c) in %s\n", type, filename);
+            exit(1);
+        }
+        if (index < 0 || index >= trace->num_ids) {
+            fprintf(stderr, "Block id %d out of range in %s\n", index, filename);
+            exit(1);
+        }
+        trace->ops[op++].index = index;
+    }
+    trace->num_ops = op;
+    fclose(fp);
+    return trace;
+}
+
+static void free_trace(trace_t *trace)
+{
+    free(trace->filename);
+    free(trace->ops);
+    free(trace->blocks);
+    free(trace->sizes);
+    free(trace);
+}
+
+/*
+ * counter_overhead - cycles a pair of counter reads costs by itself,
+ *     subtracted from every measurement
+ */
+static double counter_overhead(void)
+{
+    double best = -1, cycles;
+    uint64_t start;
+    int i;
+
+    for (i = 0; i < OVERHEAD_RUNS; i++) {
+        start = read_cycles();
+        cycles = read_cycles() - start;
+        if (best < 0 || cycles < best)
+            best = cycles;
+    }
+    return best;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * summarize - sort the n measurements in cycles and fill in lat
+ */
+static void summarize(double *cycles, int n, latency_t *lat)
+{
+    lat->count = n;
+    if (n == 0) {
+        lat->p50 = lat->p99 = lat->p999 = lat->max = 0;
+        return;
+    }
+    qsort(cycles, n, sizeof(double), compare_doubles);
+    lat->p50 = cycles[(int)((n - 1) * 0.5)];
+    lat->p99 = cycles[(int)((n - 1) * 0.99)];
+    lat->p999 = cycles[(int)((n - 1) * 0.999)];
+    lat->max = cycles[n - 1];
+}
+
+/*
+ * check_trimmed_calloc - allocate a block, trim the heap and check that
+ *     a larger mm_calloc carved from the regrown top is all zero. Run
+ *     before any trace, as only memory past the highest break ever
+ *     reached is taken to be zero already.
+ */
+static void check_trimmed_calloc(void)
+{
+    static const size_t sizes[][2] = {{100, 200}, {2000, 3000}, {30000, 50000}};
+    unsigned char *p, *q;
+    size_t i, j;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed");
+        q = mm_malloc(sizes[i][0]);
+        mm_trim();
+        if (q == NULL || (p = mm_calloc(1, sizes[i][1])) == NULL)
+            app_error("allocation failed in check_trimmed_calloc");
+        for (j = 0; j < sizes[i][1]; j++) {
+            if (p[j] != 0) {
+                fprintf(stderr, "mm_calloc(1, %zu) after mm_trim has a dirty byte at %zu\n",
+                        sizes[i][1], j);
+                exit(1);
+            }
+        }
+        mm_free(p);
+        mm_free(q);
+    }
+}
+
+/*
+ * replay - run every request of trace against a fresh heap, timing
+ *     each one and sampling utilization every num_ops/samples ops.
+ *     With stats_every > 0, mm_stats is also snapshot every
+ *     stats_every ops and after the last one; with check_every > 0
+ *     the heap is checked as often, and a bad heap ends the run.
+ */
+static void replay(trace_t *trace, int samples, int stats_every, int check_every,
+                   double overhead, result_t *res)
+{
+    double *cycles[NUM_OPS];
+    int counts[NUM_OPS] = {0};
+    int interval = trace->num_ops / samples + 1;
+    size_t payload = 0, heap;
+    double elapsed;
+    uint64_t start;
+    traceop_t *req;
+    char *p;
+    int i, type;
+
+    for (type = 0; type < NUM_OPS; type++)
+        if ((cycles[type] = malloc((trace->num_ops + 1) * sizeof(double))) == NULL)
+            app_error("malloc failed in replay");
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->sizes, 0, trace->num_ids * sizeof(size_t));
+    memset(res, 0, sizeof(result_t));
+    if ((res->samples = calloc(samples + 2, sizeof(sample_t))) == NULL)
+        app_error("calloc failed in replay");
+    if (stats_every > 0 &&
+        (res->snapshots = malloc((trace->num_ops / stats_every + 2) * sizeof(snapshot_t))) == NULL)
+        app_error("malloc failed in replay");
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        req = &trace->ops[i];
+        switch (req->type) {
+        case OP_ALLOC:
+            start = read_cycles();
+            p = mm_malloc(req->size);
+            elapsed = read_cycles() - start;
+            if (p == NULL && req->size != 0)
+                app_error("mm_malloc failed");
+            trace->blocks[req->index] = p;
+            trace->sizes[req->index] = req->size;
+            payload += req->size;
+            break;
+        case OP_REALLOC:
+            start = read_cycles();
+            p = mm_realloc(trace->blocks[req->index], req->size);
+            elapsed = read_cycles() - start;
+            if (p == NULL && req->size != 0)
+                app_error("mm_realloc failed");
+            payload += req->size - trace->sizes[req->index];
+            trace->blocks[req->index] = p;
+            trace->sizes[req->index] = req->size;
+            break;
+        default:
+            start = read_cycles();
+            mm_free(trace->blocks[req->index]);
+            elapsed = read_cycles() - start;
+            payload -= trace->sizes[req->index];
+            trace->blocks[req->index] = NULL;
+            trace->sizes[req->index] = 0;
+            break;
+        }
+
+        elapsed -= overhead;
+        cycles[req->type][counts[req->type]++] = (elapsed > 0) ? elapsed : 0;
+
+        heap = mem_heapsize();
+        if (payload > res->peak_payload)
+            res->peak_payload = payload;
+        if (heap > 0 && (double)payload / heap > res->peak_util)
+            res->peak_util = (double)payload / heap;
+        if (i % interval == 0 || i == trace->num_ops - 1) {
+            res->samples[res->num_samples].op = i;
+            res->samples[res->num_samples].payload = payload;
+            res->samples[res->num_samples].heap = heap;
+            res->num_samples++;
+        }
+        if (stats_every > 0 && ((i + 1) % stats_every == 0 || i == trace->num_ops - 1)) {
+            res->snapshots[res->num_snapshots].op = i;
+            mm_stats(&res->snapshots[res->num_snapshots++].stats);
+        }
+        if (check_every > 0 && ((i + 1) % check_every == 0 || i == trace->num_ops - 1)
+            && mm_check() != 0) {
+            fprintf(stderr, "%s: heap check failed after op %d\n", trace->filename, i);
+            exit(1);
+        }
+    }
+
+    res->final_heap = mem_heapsize();
+    res->util = res->final_heap ? (double)res->peak_payload / res->final_heap : 0;
+    for (type = 0; type < NUM_OPS; type++) {
+        summarize(cycles[type], counts[type], &res->latency[type]);
+        free(cycles[type]);
+    }
+}
+
+static void print_text(FILE *out, trace_t *trace, result_t *res)
+{
+    int type, i;
+
+    fprintf(out, "%s: %d ops, util %.1f%% (peak payload %zu, heap %zu), best %.1f%%\n",
+            trace->filename, trace->num_ops, 100 * res->util,
+            res->peak_payload, res->final_heap, 100 * res->peak_util);
+    fprintf(out, "  %-8s %8s %10s %10s %10s %10s   (cycles)\n",
+            "op", "count", "p50", "p99", "p99.9", "max");
+    for (type = 0; type < NUM_OPS; type++) {
+        latency_t *lat = &res->latency[type];
+        fprintf(out, "  %-8s %8d %10.0f %10.0f %10.0f %10.0f\n", op_names[type],
+                lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+    }
+    fprintf(out, "  %-8s %10s %10s %6s\n", "op#", "payload", "heap", "util");
+    for (i = 0; i < res->num_samples; i++) {
+        sample_t *s = &res->samples[i];
+        fprintf(out, "  %-8d %10zu %10zu %5.1f%%\n", s->op, s->payload, s->heap,
+                s->heap ? 100.0 * s->payload / s->heap : 0);
+    }
+    for (i = 0; i < res->num_snapshots; i++) {
+        fprintf(out, "  stats after op %d\n", res->snapshots[i].op);
+        mm_stats_print(out, &res->snapshots[i].stats, 0);
+    }
+}
+
+/*
+ * print_json_string - write s as a JSON string literal
+ */
+static void print_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void print_json(FILE *out, trace_t *trace, result_t *res)
+{
+    int type, i;
+
+    fprintf(out, "{\"file\": ");
+    print_json_string(out, trace->filename);
+    fprintf(out, ", \"ops\": %d, \"util\": %.4f, \"peak_util\": %.4f, "
+            "\"peak_payload\": %zu, \"heap\": %zu,\n   \"latency_cycles\": {",
+            trace->num_ops, res->util, res->peak_util, res->peak_payload, res->final_heap);
+    for (type = 0; type < NUM_OPS; type++) {
+        latency_t *lat = &res->latency[type];
+        fprintf(out, "%s\"%s\": {\"count\": %d, \"p50\": %.0f, \"p99\": %.0f, "
+                "\"p99.9\": %.0f, \"max\": %.0f}", type ? ",\n     " : "",
+                op_names[type], lat->count, lat->p50, lat->p99, lat->p999, lat->max);
+    }
+    fprintf(out, "},\n   \"timeline\": [");
+    for (i = 0; i < res->num_samples; i++) {
+        sample_t *s = &res->samples[i];
+        fprintf(out, "%s{\"op\": %d, \"payload\": %zu, \"heap\": %zu}",
+                i ? ", " : "", s->op, s->payload, s->heap);
+    }
+    fprintf(out, "]");
+    if (res->num_snapshots > 0) {
+        fprintf(out, ",\n   \"stats\": [");
+        for (i = 0; i < res->num_snapshots; i++) {
+            fprintf(out, "%s{\"op\": %d, \"stats\": ", i ? ",\n     " : "",
+                    res->snapshots[i].op);
+            mm_stats_print(out, &res->snapshots[i].stats, 1);
+            fprintf(out, "}");
+        }
+        fprintf(out, "]");
+    }
+    fprintf(out, "}");
+}
+
+/*
+ * add_dir_traces - append every .rep file in dir to the list
+ */
+static int add_dir_traces(const char *dir, char ***files, int num_files)
+{
+    DIR *dp;
+    struct dirent *ent;
+    size_t len;
+
+    if ((dp = opendir(dir)) == NULL) {
+        fprintf(stderr, "Could not open directory %s\n", dir);
+        exit(1);
+    }
+    while ((ent = readdir(dp)) != NULL) {
+        len = strlen(ent->d_name);
+        if (len < 4 || strcmp(ent->d_name + len - 4, ".rep") != 0)
+            continue;
+        if ((*files = realloc(*files, (num_files + 1) * sizeof(char *))) == NULL)
+            app_error("realloc failed in add_dir_traces");
+        if (((*files)[num_files] = malloc(strlen(dir) + len + 2)) == NULL)
+            app_error("malloc failed in add_dir_traces");
+        sprintf((*files)[num_files++], "%s/%s", dir, ent->d_name);
+    }
+    closedir(dp);
+    return num_files;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int main(int argc, char **argv)
+{
+    char **files = NULL;
+    int num_files = 0;
+    int json = 0, samples = DEFAULT_SAMPLES, stats_every = 0, check_every = 0;
+    FILE *out = stdout;
+    trace_t *trace;
+    result_t res;
+    double overhead;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "c:hjo:s:S:t:")) != EOF) {
+        switch (c) {
+        case 'c':
+            if ((check_every = atoi(optarg)) < 1)
+                app_error("-c needs a positive count");
+            break;
+        case 'j':
+            json = 1;
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                fprintf(stderr, "Could not open %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            if ((samples = atoi(optarg)) < 1)
+                app_error("-s needs a positive count");
+            break;
+        case 'S':
+            if ((stats_every = atoi(optarg)) < 1)
+                app_error("-S needs a positive count");
+            break;
+        case 't':
+            num_files = add_dir_traces(optarg, &files, num_files);
+            break;
+        case 'h':
+            usage(argv[0]);
+            exit(0);
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    qsort(files, num_files, sizeof(char *), compare_names);
+    for (i = optind; i < argc; i++) {
+        if ((files = realloc(files, (num_files + 1) * sizeof(char *))) == NULL)
+            app_error("realloc failed in main");
+        files[num_files++] = strdup(argv[i]);
+    }
+    if (num_files == 0) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    mem_init();
+    if (check_every > 0)
+        check_trimmed_calloc();
+    overhead = counter_overhead();
+
+    if (json)
+        fprintf(out, "{\"counter_overhead_cycles\": %.0f,\n \"traces\": [\n  ", overhead);
+    for (i = 0; i < num_files; i++) {
+        trace = read_trace(files[i]);
+        replay(trace, samples, stats_every, check_every, overhead, &res);
+        if (json) {
+            if (i)
+                fprintf(out, ",\n  ");
+            print_json(out, trace, &res);
+        } else {
+            print_text(out, trace, &res);
+        }
+        free(res.samples);
+        free(res.snapshots);
+        free_trace(trace);
+        free(files[i]);
+    }
+    if (json)
+        fprintf(out, "\n ]}\n");
+
+    free(files);
+    mem_deinit();
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}